@@ -0,0 +1,89 @@
+#include "arena.h"
+
+#include "constants.h"
+#include "shmem.h"
+
+#define ARENA_ALIGNMENT _Alignof(max_align_t)
+
+struct ArenaChunk {
+  struct ArenaChunk* next;
+  size_t size;  // Usable bytes in the chunk
+  size_t used;  // Bytes handed out so far
+  _Alignas(max_align_t) char data[];
+};
+
+static size_t align_up(size_t size) { return (size + ARENA_ALIGNMENT - 1) & ~(ARENA_ALIGNMENT - 1); }
+
+/// Allocates a zeroed chunk able to hold at least size bytes.
+static struct ArenaChunk* new_chunk(size_t size) {
+  struct ArenaChunk* chunk = shmem_calloc(1, sizeof(struct ArenaChunk) + size);
+  if (chunk == NULL) {
+    return NULL;
+  }
+
+  chunk->size = size;
+  return chunk;
+}
+
+void arena_init(struct Arena* arena) {
+  arena->chunks = NULL;
+  shmem_mutex_init(&arena->lock);
+}
+
+/// Allocates from the arena, with its lock held.
+static void* arena_alloc_locked(struct Arena* arena, size_t size) {
+  struct ArenaChunk* current = arena->chunks;
+  if (current != NULL && current->size - current->used >= size) {
+    void* ptr = current->data + current->used;
+    current->used += size;
+    return ptr;
+  }
+
+  // Requests larger than a quarter chunk get a chunk of their own, kept behind the one being
+  // carved so that its free space is not given up.
+  if (size > ARENA_CHUNK_SIZE / 4) {
+    struct ArenaChunk* chunk = new_chunk(size);
+    if (chunk == NULL) {
+      return NULL;
+    }
+
+    chunk->used = size;
+    if (current != NULL) {
+      chunk->next = current->next;
+      current->next = chunk;
+    } else {
+      arena->chunks = chunk;
+    }
+    return chunk->data;
+  }
+
+  struct ArenaChunk* chunk = new_chunk(ARENA_CHUNK_SIZE);
+  if (chunk == NULL) {
+    return NULL;
+  }
+
+  chunk->next = current;
+  chunk->used = size;
+  arena->chunks = chunk;
+  return chunk->data;
+}
+
+void* arena_alloc(struct Arena* arena, size_t size) {
+  pthread_mutex_lock(&arena->lock);
+  void* ptr = arena_alloc_locked(arena, align_up(size ? size : 1));
+  pthread_mutex_unlock(&arena->lock);
+  return ptr;
+}
+
+void arena_destroy(struct Arena* arena) {
+  struct ArenaChunk* chunk = arena->chunks;
+
+  while (chunk != NULL) {
+    struct ArenaChunk* next = chunk->next;
+    shmem_free(chunk);
+    chunk = next;
+  }
+
+  arena->chunks = NULL;
+  pthread_mutex_destroy(&arena->lock);
+}
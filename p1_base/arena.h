@@ -0,0 +1,30 @@
+#ifndef EMS_ARENA_H
+#define EMS_ARENA_H
+
+#include <pthread.h>
+#include <stddef.h>
+
+struct ArenaChunk;
+
+/// Bump allocator handing out zeroed memory carved from large chunks. Memory is never freed
+/// piece by piece; every chunk is released at once when the arena is destroyed.
+struct Arena {
+  struct ArenaChunk* chunks;  /// Chunks allocated so far, the one being carved first.
+  pthread_mutex_t lock;       /// Serializes allocations.
+};
+
+/// Initializes an empty arena.
+/// @param arena Arena to initialize.
+void arena_init(struct Arena* arena);
+
+/// Allocates zeroed memory suitably aligned for any type.
+/// @param arena Arena to allocate from.
+/// @param size Number of bytes to allocate.
+/// @return Pointer to the memory, NULL on failure.
+void* arena_alloc(struct Arena* arena, size_t size);
+
+/// Releases every chunk of the arena.
+/// @param arena Arena to destroy.
+void arena_destroy(struct Arena* arena);
+
+#endif  // EMS_ARENA_H
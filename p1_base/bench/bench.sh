@@ -0,0 +1,66 @@
+#!/bin/sh
+# Runs ems over generated job files and reports its throughput and latencies.
+#
+# Usage: bench/bench.sh [ems arguments...]
+# Environment:
+#   FILES     number of job files (default 4)
+#   EVENTS    events each job file creates, with ids of its own (default 100)
+#   COMMANDS  commands per job file with no state access delay (default 20000)
+#   SLOW_COMMANDS  commands per job file with the default delay (default 20)
+#   JOBGEN_ARGS    extra arguments for jobgen, e.g. "-f 8 -z 1.2"
+#
+# Reservations rejected because a seat was already taken are part of the workload and counted;
+# any other error ems reports fails the run, so broken commands cannot pass for throughput.
+
+set -e
+
+cd "$(dirname "$0")/.."
+
+FILES=${FILES:-4}
+EVENTS=${EVENTS:-100}
+COMMANDS=${COMMANDS:-20000}
+SLOW_COMMANDS=${SLOW_COMMANDS:-20}
+DIR=$(mktemp -d)
+trap 'rm -rf "$DIR"' EXIT
+
+now_ms() {
+  date +%s%N | cut -c1-13
+}
+
+# run <label> <commands per file> <delay or empty> <ems arguments...>
+run() {
+  label=$1
+  commands=$2
+  delay=$3
+  shift 3
+
+  rm -f "$DIR"/*.jobs "$DIR"/*.out "$DIR"/stats "$DIR"/errors
+  i=1
+  while [ "$i" -le "$FILES" ]; do
+    # shellcheck disable=SC2086
+    ./jobgen -n "$commands" -S "$i" -e "$EVENTS" -o $(((i - 1) * EVENTS + 1)) $JOBGEN_ARGS >"$DIR/bench$i.jobs"
+    i=$((i + 1))
+  done
+  total=$(cat "$DIR"/*.jobs | wc -l)
+
+  start=$(now_ms)
+  # shellcheck disable=SC2086
+  ./ems -s "$DIR/stats" "$@" "$DIR" $delay >/dev/null 2>"$DIR/errors"
+  end=$(now_ms)
+
+  if grep -v -x -e 'Seat already reserved' -e 'Failed to reserve seats' "$DIR/errors" >"$DIR/unexpected"; then
+    echo "== $label: ems reported errors:" >&2
+    sort "$DIR/unexpected" | uniq -c >&2
+    exit 1
+  fi
+  rejected=$(grep -c -x 'Failed to reserve seats' "$DIR/errors" || true)
+
+  elapsed=$((end - start))
+  [ "$elapsed" -gt 0 ] || elapsed=1
+
+  echo "== $label: $total commands in $elapsed ms, $((total * 1000 / elapsed)) commands/s, $rejected reservations rejected"
+  grep -v '^file ' "$DIR/stats"
+}
+
+run "delay 0" "$COMMANDS" 0 "$@"
+run "default delay" "$SLOW_COMMANDS" "" "$@"
@@ -0,0 +1,210 @@
+#include <limits.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#define MAX_FAN_OUT 255  // Seats per reservation the parser accepts
+
+/// Shape of the generated workload.
+struct Workload {
+  unsigned int events;       // Number of events created up front
+  unsigned int first_event;  // Id of the first event, the others following it
+  unsigned int rows;         // Rows of every event
+  unsigned int cols;         // Columns of every event
+  unsigned int commands;     // Number of commands after the creates
+  unsigned int fan_out;      // Maximum number of seats per reservation
+  unsigned int show_pct;     // Percentage of SHOW commands
+  unsigned int list_pct;     // Percentage of LIST commands
+  double skew;               // Zipf exponent of event popularity, 0 for uniform
+  uint64_t seed;             // Seed of the random generator
+};
+
+static uint64_t rng_state;
+
+/// xorshift64* generator, so the same seed produces the same file everywhere.
+static uint64_t next_random() {
+  rng_state ^= rng_state >> 12;
+  rng_state ^= rng_state << 25;
+  rng_state ^= rng_state >> 27;
+  return rng_state * 0x2545F4914F6CDD1DULL;
+}
+
+/// Draws a number uniformly from [1, max].
+static unsigned int uniform(unsigned int max) { return (unsigned int)(next_random() % max) + 1; }
+
+/// Draws a number uniformly from [0, 1).
+static double unit() { return (double)(next_random() >> 11) / 9007199254740992.0; }
+
+/// Builds the cumulative distribution of a Zipf law over events 1 to n.
+static double *zipf_cdf(unsigned int n, double skew) {
+  double *cdf = malloc(n * sizeof(double));
+  if (cdf == NULL) {
+    return NULL;
+  }
+
+  double sum = 0;
+  for (unsigned int k = 1; k <= n; k++) {
+    sum += 1.0 / pow((double)k, skew);
+    cdf[k - 1] = sum;
+  }
+  for (unsigned int k = 0; k < n; k++) {
+    cdf[k] /= sum;
+  }
+
+  return cdf;
+}
+
+/// Draws an event id following the given distribution.
+static unsigned int pick_event(const double *cdf, unsigned int n) {
+  double u = unit();
+  unsigned int lo = 0, hi = n - 1;
+
+  while (lo < hi) {
+    unsigned int mid = lo + (hi - lo) / 2;
+    if (cdf[mid] < u) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+
+  return lo + 1;
+}
+
+static int parse_uint(const char *arg, unsigned int *value) {
+  char *endptr;
+  unsigned long ul = strtoul(arg, &endptr, 10);
+
+  if (*arg == '\0' || *endptr != '\0' || ul > UINT_MAX) {
+    return 1;
+  }
+
+  *value = (unsigned int)ul;
+  return 0;
+}
+
+static void usage(const char *prog) {
+  fprintf(stderr,
+          "Usage: %s [-e events] [-o first_event] [-r rows] [-c cols] [-n commands] [-f fan_out]\n"
+          "          [-s show_pct] [-l list_pct] [-z skew] [-S seed]\n",
+          prog);
+}
+
+int main(int argc, char *argv[]) {
+  struct Workload w = {.events = 100,
+                       .first_event = 1,
+                       .rows = 20,
+                       .cols = 20,
+                       .commands = 10000,
+                       .fan_out = 4,
+                       .show_pct = 5,
+                       .list_pct = 1,
+                       .skew = 0.99,
+                       .seed = 1};
+  int opt;
+  int invalid = 0;
+
+  while ((opt = getopt(argc, argv, "e:o:r:c:n:f:s:l:z:S:")) != -1) {
+    unsigned int seed;
+
+    switch (opt) {
+      case 'e':
+        invalid |= parse_uint(optarg, &w.events) || w.events == 0;
+        break;
+      case 'o':
+        invalid |= parse_uint(optarg, &w.first_event) || w.first_event == 0;
+        break;
+      case 'r':
+        invalid |= parse_uint(optarg, &w.rows) || w.rows == 0;
+        break;
+      case 'c':
+        invalid |= parse_uint(optarg, &w.cols) || w.cols == 0;
+        break;
+      case 'n':
+        invalid |= parse_uint(optarg, &w.commands);
+        break;
+      case 'f':
+        invalid |= parse_uint(optarg, &w.fan_out) || w.fan_out == 0 || w.fan_out > MAX_FAN_OUT;
+        break;
+      case 's':
+        invalid |= parse_uint(optarg, &w.show_pct);
+        break;
+      case 'l':
+        invalid |= parse_uint(optarg, &w.list_pct);
+        break;
+      case 'z':
+        w.skew = strtod(optarg, NULL);
+        invalid |= w.skew < 0;
+        break;
+      case 'S':
+        invalid |= parse_uint(optarg, &seed);
+        w.seed = seed;
+        break;
+      default:
+        invalid = 1;
+        break;
+    }
+  }
+
+  if (invalid || w.show_pct + w.list_pct > 100 || w.events - 1 > UINT_MAX - w.first_event) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  rng_state = w.seed * 0x9E3779B97F4A7C15ULL + 1;
+
+  double *cdf = zipf_cdf(w.events, w.skew);
+  if (cdf == NULL) {
+    fprintf(stderr, "Error allocating memory for the event distribution\n");
+    return 1;
+  }
+
+  // Event ids are drawn from 1 to events and shifted, so files generated with disjoint ranges never
+  // create the same event.
+  unsigned int offset = w.first_event - 1;
+
+  for (unsigned int id = 1; id <= w.events; id++) {
+    printf("CREATE %u %u %u\n", offset + id, w.rows, w.cols);
+  }
+
+  for (unsigned int i = 0; i < w.commands; i++) {
+    unsigned int roll = uniform(100);
+
+    if (roll <= w.show_pct) {
+      printf("SHOW %u\n", offset + pick_event(cdf, w.events));
+    } else if (roll <= w.show_pct + w.list_pct) {
+      printf("LIST\n");
+    } else {
+      unsigned int seats = uniform(w.fan_out);
+      unsigned int event = pick_event(cdf, w.events);
+      unsigned int xs[MAX_FAN_OUT], ys[MAX_FAN_OUT];
+
+      // A reservation naming a seat twice always fails, so seats are redrawn until distinct.
+      if ((uint64_t)seats > (uint64_t)w.rows * w.cols) {
+        seats = w.rows * w.cols;
+      }
+      for (unsigned int s = 0; s < seats; s++) {
+        int repeated;
+        do {
+          xs[s] = uniform(w.rows);
+          ys[s] = uniform(w.cols);
+          repeated = 0;
+          for (unsigned int t = 0; t < s && !repeated; t++) {
+            repeated = xs[t] == xs[s] && ys[t] == ys[s];
+          }
+        } while (repeated);
+      }
+
+      printf("RESERVE %u [", offset + event);
+      for (unsigned int s = 0; s < seats; s++) {
+        printf(s ? " (%u,%u)" : "(%u,%u)", xs[s], ys[s]);
+      }
+      printf("]\n");
+    }
+  }
+
+  free(cdf);
+  return 0;
+}
@@ -0,0 +1,234 @@
+#include "api.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "../constants.h"
+#include "../protocol.h"
+
+/// Session of this process, if any.
+static struct {
+  int req_fd;
+  int resp_fd;
+  int session_id;
+  char req_path[PIPE_PATH_SIZE];
+  char resp_path[PIPE_PATH_SIZE];
+} session = {.req_fd = -1, .resp_fd = -1, .session_id = -1};
+
+/// Creates a named pipe, replacing any file left at the same path.
+static int create_pipe(const char *path) {
+  if (unlink(path) != 0 && errno != ENOENT) {
+    perror("Failed to remove old pipe");
+    return 1;
+  }
+
+  if (mkfifo(path, 0640) != 0) {
+    perror("Failed to create pipe");
+    return 1;
+  }
+
+  return 0;
+}
+
+/// Closes and removes the pipes of the session.
+static void close_session() {
+  if (session.req_fd >= 0) close(session.req_fd);
+  if (session.resp_fd >= 0) close(session.resp_fd);
+  unlink(session.req_path);
+  unlink(session.resp_path);
+
+  session.req_fd = -1;
+  session.resp_fd = -1;
+  session.session_id = -1;
+}
+
+/// Reads the result of a request from the server.
+static int receive_result() {
+  int result;
+
+  if (protocol_read(session.resp_fd, &result, sizeof(result)) != 0) {
+    fprintf(stderr, "Lost connection to the server\n");
+    return 1;
+  }
+
+  return result;
+}
+
+/// Reads the output of a request that prints and copies it to a file descriptor.
+static int receive_rendered(int fdOut) {
+  int result = receive_result();
+  if (result != 0) {
+    return result;
+  }
+
+  size_t len;
+  if (protocol_read(session.resp_fd, &len, sizeof(len)) != 0) {
+    fprintf(stderr, "Lost connection to the server\n");
+    return 1;
+  }
+
+  char *text = malloc(len > 0 ? len : 1);
+  if (text == NULL) {
+    fprintf(stderr, "Error allocating memory for reply\n");
+    return 1;
+  }
+
+  result = protocol_read(session.resp_fd, text, len);
+  if (result != 0) {
+    fprintf(stderr, "Lost connection to the server\n");
+  } else if (protocol_write(fdOut, text, len) != 0) {
+    perror("Failed to write output");
+    result = 1;
+  }
+
+  free(text);
+  return result;
+}
+
+/// Sends a request to the server, which must start with its operation code.
+static int send_request(const void *request, size_t len) {
+  if (session.req_fd < 0) {
+    fprintf(stderr, "No session with the server\n");
+    return 1;
+  }
+
+  if (protocol_write(session.req_fd, request, len) != 0) {
+    fprintf(stderr, "Lost connection to the server\n");
+    return 1;
+  }
+
+  return 0;
+}
+
+int ems_setup(const char *req_pipe_path, const char *resp_pipe_path, const char *server_pipe_path) {
+  if (session.req_fd >= 0) {
+    fprintf(stderr, "Session already set up\n");
+    return 1;
+  }
+
+  if (strlen(req_pipe_path) >= PIPE_PATH_SIZE || strlen(resp_pipe_path) >= PIPE_PATH_SIZE) {
+    fprintf(stderr, "Pipe path too long\n");
+    return 1;
+  }
+
+  // Unused bytes are zeroed so that the message never carries leftover memory.
+  char message[1 + 2 * PIPE_PATH_SIZE] = {OP_SETUP};
+  strcpy(message + 1, req_pipe_path);
+  strcpy(message + 1 + PIPE_PATH_SIZE, resp_pipe_path);
+  strcpy(session.req_path, req_pipe_path);
+  strcpy(session.resp_path, resp_pipe_path);
+
+  if (create_pipe(req_pipe_path) != 0) {
+    return 1;
+  }
+
+  if (create_pipe(resp_pipe_path) != 0) {
+    unlink(req_pipe_path);
+    return 1;
+  }
+
+  int server_fd = open(server_pipe_path, O_WRONLY);
+
+  if (server_fd < 0) {
+    perror("Failed to open server pipe");
+    close_session();
+    return 1;
+  }
+
+  // The message is at most PIPE_BUF bytes, so it is written in one piece.
+  int result = protocol_write(server_fd, message, sizeof(message));
+  close(server_fd);
+
+  if (result != 0) {
+    perror("Failed to register with the server");
+    close_session();
+    return 1;
+  }
+
+  // Same order as the server, which opens the request pipe first.
+  session.req_fd = open(req_pipe_path, O_WRONLY);
+  if (session.req_fd >= 0) {
+    session.resp_fd = open(resp_pipe_path, O_RDONLY);
+  }
+
+  if (session.resp_fd < 0 ||
+      protocol_read(session.resp_fd, &session.session_id, sizeof(session.session_id)) != 0) {
+    fprintf(stderr, "Failed to set up session\n");
+    close_session();
+    return 1;
+  }
+
+  return 0;
+}
+
+int ems_quit(void) {
+  char op = OP_QUIT;
+  int result = send_request(&op, 1);
+
+  close_session();
+  return result;
+}
+
+int ems_create(unsigned int event_id, size_t num_rows, size_t num_cols) {
+  char request[1 + sizeof(event_id) + 2 * sizeof(size_t)] = {OP_CREATE};
+  memcpy(request + 1, &event_id, sizeof(event_id));
+  memcpy(request + 1 + sizeof(event_id), &num_rows, sizeof(size_t));
+  memcpy(request + 1 + sizeof(event_id) + sizeof(size_t), &num_cols, sizeof(size_t));
+
+  if (send_request(request, sizeof(request)) != 0) {
+    return 1;
+  }
+
+  return receive_result();
+}
+
+int ems_reserve(unsigned int event_id, size_t num_seats, size_t *xs, size_t *ys) {
+  if (num_seats > MAX_RESERVATION_SIZE) {
+    fprintf(stderr, "Too many seats\n");
+    return 1;
+  }
+
+  char request[1 + sizeof(event_id) + sizeof(size_t) + 2 * MAX_RESERVATION_SIZE * sizeof(size_t)] = {OP_RESERVE};
+  char *end = request + 1;
+
+  memcpy(end, &event_id, sizeof(event_id));
+  end += sizeof(event_id);
+  memcpy(end, &num_seats, sizeof(size_t));
+  end += sizeof(size_t);
+  memcpy(end, xs, num_seats * sizeof(size_t));
+  end += num_seats * sizeof(size_t);
+  memcpy(end, ys, num_seats * sizeof(size_t));
+  end += num_seats * sizeof(size_t);
+
+  if (send_request(request, (size_t)(end - request)) != 0) {
+    return 1;
+  }
+
+  return receive_result();
+}
+
+int ems_show(unsigned int event_id, int fdOut) {
+  char request[1 + sizeof(event_id)] = {OP_SHOW};
+  memcpy(request + 1, &event_id, sizeof(event_id));
+
+  if (send_request(request, sizeof(request)) != 0) {
+    return 1;
+  }
+
+  return receive_rendered(fdOut);
+}
+
+int ems_list_events(int fdOut) {
+  char op = OP_LIST_EVENTS;
+
+  if (send_request(&op, 1) != 0) {
+    return 1;
+  }
+
+  return receive_rendered(fdOut);
+}
@@ -0,0 +1,44 @@
+#ifndef EMS_CLIENT_API_H
+#define EMS_CLIENT_API_H
+
+#include <stddef.h>
+
+/// Registers a session with an EMS server, creating the request and response pipes.
+/// @note A process holds at most one session at a time.
+/// @param req_pipe_path Path of the pipe to create for requests.
+/// @param resp_pipe_path Path of the pipe to create for responses.
+/// @param server_pipe_path Path of the registration pipe of the server.
+/// @return 0 if the session was set up successfully, 1 otherwise.
+int ems_setup(const char *req_pipe_path, const char *resp_pipe_path, const char *server_pipe_path);
+
+/// Ends the session, closing and removing its pipes.
+/// @return 0 if the session was ended successfully, 1 otherwise.
+int ems_quit(void);
+
+/// Creates a new event with the given id and dimensions.
+/// @param event_id Id of the event to be created.
+/// @param num_rows Number of rows of the event to be created.
+/// @param num_cols Number of columns of the event to be created.
+/// @return 0 if the event was created successfully, 1 otherwise.
+int ems_create(unsigned int event_id, size_t num_rows, size_t num_cols);
+
+/// Creates a new reservation for the given event.
+/// @param event_id Id of the event to create a reservation for.
+/// @param num_seats Number of seats to reserve.
+/// @param xs Array of rows of the seats to reserve.
+/// @param ys Array of columns of the seats to reserve.
+/// @return 0 if the reservation was created successfully, 1 otherwise.
+int ems_reserve(unsigned int event_id, size_t num_seats, size_t *xs, size_t *ys);
+
+/// Prints the given event, as the server would.
+/// @param event_id Id of the event to print.
+/// @param fdOut File descriptor to print the event to.
+/// @return 0 if the event was printed successfully, 1 otherwise.
+int ems_show(unsigned int event_id, int fdOut);
+
+/// Prints all the events, as the server would.
+/// @param fdOut File descriptor to print the events to.
+/// @return 0 if the events were printed successfully, 1 otherwise.
+int ems_list_events(int fdOut);
+
+#endif  // EMS_CLIENT_API_H
@@ -0,0 +1,164 @@
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../constants.h"
+#include "../parser.h"
+#include "api.h"
+
+/// Executes the commands of a job file through the session, writing output to fdOut.
+/// @note BARRIER, RESERVE_BEST, RESERVE_RANGE, RESERVE_BLOCK and SEATS are not part of the client
+/// protocol and are skipped.
+static void run_jobs(int fd, int fdOut) {
+  while (1) {
+    unsigned int event_id, delay, wait_thread;
+    size_t num_rows, num_columns, num_coords;
+    size_t xs[MAX_RESERVATION_SIZE], ys[MAX_RESERVATION_SIZE];
+    enum Command cmd = get_next(fd);
+
+    switch (cmd) {
+      case CMD_CREATE:
+        if (parse_create(fd, &event_id, &num_rows, &num_columns) != 0) {
+          fprintf(stderr, "Invalid command. See HELP for usage\n");
+          continue;
+        }
+
+        if (ems_create(event_id, num_rows, num_columns)) {
+          fprintf(stderr, "Failed to create event\n");
+        }
+
+        break;
+
+      case CMD_RESERVE:
+        num_coords = parse_reserve(fd, MAX_RESERVATION_SIZE, &event_id, xs, ys);
+
+        if (num_coords == 0) {
+          fprintf(stderr, "Invalid command. See HELP for usage\n");
+          continue;
+        }
+
+        if (ems_reserve(event_id, num_coords, xs, ys)) {
+          fprintf(stderr, "Failed to reserve seats\n");
+        }
+
+        break;
+
+      case CMD_SHOW:
+        if (parse_show(fd, &event_id) != 0) {
+          fprintf(stderr, "Invalid command. See HELP for usage\n");
+          continue;
+        }
+
+        if (ems_show(event_id, fdOut)) {
+          fprintf(stderr, "Failed to show event\n");
+        }
+
+        break;
+
+      case CMD_LIST_EVENTS:
+        if (ems_list_events(fdOut)) {
+          fprintf(stderr, "Failed to list events\n");
+        }
+
+        break;
+
+      case CMD_WAIT:
+        if (parse_wait(fd, &delay, &wait_thread) == -1) {
+          fprintf(stderr, "Invalid command. See HELP for usage\n");
+          continue;
+        }
+
+        if (delay > 0) {
+          struct timespec ts = {delay / 1000, (delay % 1000) * 1000000};
+          printf("Waiting...\n");
+          nanosleep(&ts, NULL);
+        }
+
+        break;
+
+      case CMD_INVALID:
+        fprintf(stderr, "Invalid command. See HELP for usage\n");
+        break;
+
+      case CMD_HELP:
+        printf(
+            "Available commands:\n"
+            "  CREATE <event_id> <num_rows> <num_columns>\n"
+            "  RESERVE <event_id> [(<x1>,<y1>) (<x2>,<y2>) ...]\n"
+            "  SHOW <event_id>\n"
+            "  LIST\n"
+            "  WAIT <delay_ms>\n"
+            "  HELP\n");
+
+        break;
+
+      case CMD_BARRIER:
+      case CMD_RESERVE_BEST:
+      case CMD_RESERVE_RANGE:
+      case CMD_RESERVE_BLOCK:
+      case CMD_SEATS:
+        fprintf(stderr, "Command not supported by the client\n");
+        skip_command(fd, cmd);
+        break;
+
+      case CMD_EMPTY:
+        break;
+
+      case EOC:
+        return;
+    }
+  }
+}
+
+int main(int argc, char *argv[]) {
+  if (argc != 5) {
+    fprintf(stderr, "Usage: %s <request_pipe> <response_pipe> <register_pipe> <jobs_file>\n", argv[0]);
+    return 1;
+  }
+
+  char out_filepath[PATH_MAX];
+  if (strlen(argv[4]) + 5 > PATH_MAX) {
+    fprintf(stderr, "Job file path too long\n");
+    return 1;
+  }
+
+  strcpy(out_filepath, argv[4]);
+  char *extension = strrchr(out_filepath, '.');
+  strcpy(extension != NULL && strchr(extension, '/') == NULL ? extension : out_filepath + strlen(out_filepath),
+         ".out");
+
+  int fd = open(argv[4], O_RDONLY);
+
+  if (fd < 0) {
+    perror("Failed to open job file");
+    return 1;
+  }
+
+  int fdOut = open(out_filepath, O_CREAT | O_TRUNC | O_WRONLY, S_IRUSR | S_IWUSR);
+
+  if (fdOut < 0) {
+    perror("Failed to open output file");
+    close(fd);
+    return 1;
+  }
+
+  if (ems_setup(argv[1], argv[2], argv[3]) != 0) {
+    fprintf(stderr, "Failed to set up session\n");
+    close(fdOut);
+    close(fd);
+    return 1;
+  }
+
+  run_jobs(fd, fdOut);
+
+  int result = ems_quit();
+
+  parser_release(fd);
+  close(fdOut);
+  close(fd);
+  return result;
+}
@@ -0,0 +1,196 @@
+#include "command.h"
+
+#include <stdio.h>
+
+#include "operations.h"
+#include "trace.h"
+
+const char *command_name(enum Command cmd) {
+  switch (cmd) {
+    case CMD_CREATE:
+      return "CREATE";
+    case CMD_RESERVE:
+      return "RESERVE";
+    case CMD_RESERVE_BEST:
+      return "RESERVE_BEST";
+    case CMD_RESERVE_RANGE:
+      return "RESERVE_RANGE";
+    case CMD_RESERVE_BLOCK:
+      return "RESERVE_BLOCK";
+    case CMD_SHOW:
+      return "SHOW";
+    case CMD_SEATS:
+      return "SEATS";
+    case CMD_LIST_EVENTS:
+      return "LIST";
+    case CMD_WAIT:
+      return "WAIT";
+    case CMD_BARRIER:
+      return "BARRIER";
+    case CMD_HELP:
+      return "HELP";
+    case CMD_INVALID:
+      return "INVALID";
+    case CMD_EMPTY:
+      return "EMPTY";
+    case EOC:
+      return "EOC";
+  }
+
+  return "INVALID";
+}
+
+int parse_command(int fd, struct JobCommand *command) {
+  int valid = 1;
+  switch (command->cmd) {
+    case CMD_CREATE:
+      valid = parse_create(fd, &command->event_id, &command->num_rows, &command->num_cols) == 0;
+      break;
+
+    case CMD_RESERVE:
+      command->num_seats = parse_reserve(fd, MAX_RESERVATION_SIZE, &command->event_id, command->xs, command->ys);
+      valid = command->num_seats > 0;
+      break;
+
+    case CMD_RESERVE_BEST:
+      valid = parse_reserve_best(fd, MAX_RESERVATION_SIZE, &command->event_id, &command->num_seats) == 0;
+      break;
+
+    case CMD_RESERVE_RANGE:
+    case CMD_RESERVE_BLOCK:
+      valid = parse_reserve_block(fd, command->cmd, &command->event_id, &command->first_row, &command->first_col,
+                                  &command->last_row, &command->last_col) == 0;
+      break;
+
+    case CMD_SHOW:
+    case CMD_SEATS:
+      valid = parse_show(fd, &command->event_id) == 0;
+      break;
+
+    case CMD_WAIT:
+      switch (parse_wait(fd, &command->delay, &command->wait_thread)) {
+        case -1:
+          valid = 0;
+          break;
+
+        case 0:
+          command->wait_thread = 0;
+          break;
+
+        default:
+          break;
+      }
+      break;
+
+    case CMD_INVALID:
+      valid = 0;
+      break;
+
+    case CMD_LIST_EVENTS:
+    case CMD_BARRIER:
+    case CMD_HELP:
+    case CMD_EMPTY:
+    case EOC:
+      break;
+  }
+
+  if (!valid) {
+    command->cmd = CMD_EMPTY;
+    return 1;
+  }
+
+  return 0;
+}
+
+enum Command read_command(int fd, struct JobCommand *command) {
+  uint64_t span = trace_begin();
+  command->cmd = get_next(fd);
+
+  enum Command cmd = command->cmd;
+  int result = parse_command(fd, command);
+
+  if (cmd != CMD_EMPTY && cmd != EOC) {
+    trace_end(command_name(cmd), TRACE_PARSE, span);
+  }
+
+  if (result != 0) {
+    fprintf(stderr, "Invalid command. See HELP for usage\n");
+  }
+
+  return command->cmd;
+}
+
+void execute_command(struct JobCommand *command, int fdOut) {
+  uint64_t span = trace_begin();
+
+  switch (command->cmd) {
+    case CMD_CREATE:
+      if (ems_create(command->event_id, command->num_rows, command->num_cols)) {
+        fprintf(stderr, "Failed to create event\n");
+      }
+      break;
+
+    case CMD_RESERVE:
+      if (ems_reserve(command->event_id, command->num_seats, command->xs, command->ys)) {
+        fprintf(stderr, "Failed to reserve seats\n");
+      }
+      break;
+
+    case CMD_RESERVE_BEST:
+      if (ems_reserve_best(command->event_id, command->num_seats, fdOut)) {
+        fprintf(stderr, "Failed to reserve seats\n");
+      }
+      break;
+
+    case CMD_RESERVE_RANGE:
+    case CMD_RESERVE_BLOCK:
+      if (ems_reserve_block(command->event_id, command->first_row, command->first_col, command->last_row,
+                            command->last_col)) {
+        fprintf(stderr, "Failed to reserve seats\n");
+      }
+      break;
+
+    case CMD_SHOW:
+      if (ems_show(command->event_id, fdOut)) {
+        fprintf(stderr, "Failed to show event\n");
+      }
+      break;
+
+    case CMD_SEATS:
+      if (ems_free_seats(command->event_id, fdOut)) {
+        fprintf(stderr, "Failed to count free seats\n");
+      }
+      break;
+
+    case CMD_LIST_EVENTS:
+      if (ems_list_events(fdOut)) {
+        fprintf(stderr, "Failed to list events\n");
+      }
+      break;
+
+    case CMD_HELP:
+      printf(
+          "Available commands:\n"
+          "  CREATE <event_id> <num_rows> <num_columns>\n"
+          "  RESERVE <event_id> [(<x1>,<y1>) (<x2>,<y2>) ...]\n"
+          "  RESERVE_BEST <event_id> <num_seats>\n"
+          "  RESERVE_RANGE <event_id> <row> <first_col> <last_col>\n"
+          "  RESERVE_BLOCK <event_id> <first_row> <first_col> <last_row> <last_col>\n"
+          "  SHOW <event_id>\n"
+          "  SEATS <event_id>\n"
+          "  LIST\n"
+          "  WAIT <delay_ms> [thread_id]\n"
+          "  BARRIER\n"
+          "  HELP\n");
+      break;
+
+    case CMD_BARRIER:
+    case CMD_WAIT:
+    case CMD_EMPTY:
+    case CMD_INVALID:
+    case EOC:
+      return;
+  }
+
+  trace_end(command_name(command->cmd), TRACE_COMMAND, span);
+}
@@ -0,0 +1,52 @@
+#ifndef EMS_COMMAND_H
+#define EMS_COMMAND_H
+
+#include <stddef.h>
+
+#include "constants.h"
+#include "parser.h"
+
+/// A parsed job command with its arguments, so that it can be run away from the file it came from.
+struct JobCommand {
+  enum Command cmd;
+  unsigned int event_id;
+  size_t num_rows;           /// CREATE
+  size_t num_cols;           /// CREATE
+  size_t num_seats;          /// RESERVE and RESERVE_BEST
+  size_t first_row;          /// RESERVE_RANGE and RESERVE_BLOCK
+  size_t first_col;          /// RESERVE_RANGE and RESERVE_BLOCK
+  size_t last_row;           /// RESERVE_RANGE and RESERVE_BLOCK
+  size_t last_col;           /// RESERVE_RANGE and RESERVE_BLOCK
+  unsigned int delay;        /// WAIT
+  unsigned int wait_thread;  /// WAIT, 0 if every thread waits
+  size_t xs[MAX_RESERVATION_SIZE];
+  size_t ys[MAX_RESERVATION_SIZE];
+};
+
+/// Gets the name of a command as written in job files.
+/// @param cmd Command type.
+/// @return Name of the command, a string literal.
+const char *command_name(enum Command cmd);
+
+/// Parses the arguments of a command whose type get_next returned.
+/// @note Nothing is reported on failure, so that the caller can decide who reports it.
+/// @param fd File descriptor to read from.
+/// @param command Command to fill in, with its type already set.
+/// @return 0 if the arguments were parsed successfully, 1 otherwise, in which case the command
+/// becomes CMD_EMPTY.
+int parse_command(int fd, struct JobCommand *command);
+
+/// Reads the next command of a job file with its arguments.
+/// @note Malformed commands are reported on stderr and read as CMD_EMPTY.
+/// @param fd File descriptor to read from.
+/// @param command Command to fill in.
+/// @return The type of the command read.
+enum Command read_command(int fd, struct JobCommand *command);
+
+/// Executes a command that works on the state (CREATE, RESERVE, RESERVE_BEST, RESERVE_RANGE,
+/// RESERVE_BLOCK, SHOW, SEATS and LIST) or prints the usage (HELP), reporting failures on stderr. Other commands are ignored.
+/// @param command Command to execute.
+/// @param fdOut File descriptor to print output to.
+void execute_command(struct JobCommand *command, int fdOut);
+
+#endif  // EMS_COMMAND_H
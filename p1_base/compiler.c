@@ -0,0 +1,141 @@
+#include "compiler.h"
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "constants.h"
+#include "parser.h"
+#include "writer.h"
+
+/// Output is flushed whenever this much of it is buffered.
+#define COMPILER_FLUSH_SIZE (1 << 20)
+
+/// Appends a LEB128 varint.
+static void put_varint(struct Writer *writer, uint64_t value) {
+  while (value >= 0x80) {
+    writer_put_char(writer, (char)(0x80 | (value & 0x7F)));
+    value >>= 7;
+  }
+  writer_put_char(writer, (char)value);
+}
+
+/// Appends an opcode.
+/// @param malformed Whether the arguments of the command failed to parse.
+static void put_opcode(struct Writer *writer, enum Command cmd, int malformed) {
+  writer_put_char(writer, (char)((unsigned int)cmd | (malformed ? BINARY_JOBS_MALFORMED : 0)));
+}
+
+int compile_jobs(int fd, int fdOut) {
+  struct Writer writer;
+  writer_init(&writer, COMPILER_FLUSH_SIZE);
+  writer_put(&writer, BINARY_JOBS_MAGIC, BINARY_JOBS_MAGIC_LEN);
+
+  while (1) {
+    unsigned int event_id, delay, thread_id;
+    size_t num_rows, num_columns, num_coords;
+    size_t first_row, first_col, last_row, last_col;
+    size_t xs[MAX_RESERVATION_SIZE], ys[MAX_RESERVATION_SIZE];
+    enum Command cmd = get_next(fd);
+    int result;
+
+    switch (cmd) {
+      case CMD_CREATE:
+        result = parse_create(fd, &event_id, &num_rows, &num_columns);
+        put_opcode(&writer, cmd, result != 0);
+
+        if (result == 0) {
+          put_varint(&writer, event_id);
+          put_varint(&writer, num_rows);
+          put_varint(&writer, num_columns);
+        }
+        break;
+
+      case CMD_RESERVE:
+        num_coords = parse_reserve(fd, MAX_RESERVATION_SIZE, &event_id, xs, ys);
+        put_opcode(&writer, cmd, num_coords == 0);
+
+        if (num_coords != 0) {
+          put_varint(&writer, event_id);
+          put_varint(&writer, num_coords);
+          for (size_t i = 0; i < num_coords; i++) {
+            put_varint(&writer, xs[i]);
+            put_varint(&writer, ys[i]);
+          }
+        }
+        break;
+
+      case CMD_RESERVE_BEST:
+        result = parse_reserve_best(fd, MAX_RESERVATION_SIZE, &event_id, &num_coords);
+        put_opcode(&writer, cmd, result != 0);
+
+        if (result == 0) {
+          put_varint(&writer, event_id);
+          put_varint(&writer, num_coords);
+        }
+        break;
+
+      case CMD_RESERVE_RANGE:
+      case CMD_RESERVE_BLOCK:
+        result = parse_reserve_block(fd, cmd, &event_id, &first_row, &first_col, &last_row, &last_col);
+        put_opcode(&writer, cmd, result != 0);
+
+        if (result == 0) {
+          put_varint(&writer, event_id);
+          put_varint(&writer, first_row);
+          put_varint(&writer, first_col);
+          if (cmd == CMD_RESERVE_BLOCK) {
+            put_varint(&writer, last_row);
+          }
+          put_varint(&writer, last_col);
+        }
+        break;
+
+      case CMD_SHOW:
+      case CMD_SEATS:
+        result = parse_show(fd, &event_id);
+        put_opcode(&writer, cmd, result != 0);
+
+        if (result == 0) {
+          put_varint(&writer, event_id);
+        }
+        break;
+
+      case CMD_WAIT:
+        result = parse_wait(fd, &delay, &thread_id);
+
+        if (result == 1) {
+          writer_put_char(&writer, (char)((unsigned int)cmd | BINARY_JOBS_THREAD));
+        } else {
+          put_opcode(&writer, cmd, result == -1);
+        }
+
+        if (result != -1) {
+          put_varint(&writer, delay);
+        }
+        if (result == 1) {
+          put_varint(&writer, thread_id);
+        }
+        break;
+
+      case CMD_LIST_EVENTS:
+      case CMD_BARRIER:
+      case CMD_HELP:
+      case CMD_INVALID:
+        put_opcode(&writer, cmd, 0);
+        break;
+
+      case CMD_EMPTY:
+        break;
+
+      case EOC:
+        result = writer_flush(&writer, fdOut);
+        writer_destroy(&writer);
+        return result;
+    }
+
+    if (writer.len >= COMPILER_FLUSH_SIZE && writer_flush(&writer, fdOut) != 0) {
+      writer_destroy(&writer);
+      return 1;
+    }
+  }
+}
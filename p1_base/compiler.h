@@ -0,0 +1,10 @@
+#ifndef EMS_COMPILER_H
+#define EMS_COMPILER_H
+
+/// Compiles a text job file into the binary format described in parser.h.
+/// @param fd File descriptor of the text job file.
+/// @param fdOut File descriptor to write the compiled job file to.
+/// @return 0 if the file was compiled successfully, 1 otherwise.
+int compile_jobs(int fd, int fdOut);
+
+#endif  // EMS_COMPILER_H
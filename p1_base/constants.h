@@ -1,2 +1,20 @@
 #define MAX_RESERVATION_SIZE 256
 #define STATE_ACCESS_DELAY_MS 10
+#define DEFAULT_MAX_PROC 1
+#define DEFAULT_MAX_THREADS 1
+#define SEAT_LOCK_STRIPES 64
+#define READER_BUFFER_SIZE 65536
+#define MAX_READERS 1024
+#define ARENA_CHUNK_SIZE (1 << 20)
+#define RESERVE_BEST_ATTEMPTS 8
+#define SPARSE_MIN_SEATS 65536
+#define SPARSE_PROMOTE_PERCENT 10
+#define DEFAULT_MAX_SESSIONS 8
+#define SESSION_QUEUE_SIZE 16
+#define PIPELINE_DEPTH 64
+#define SHOW_CACHE_BYTES (64 << 20)
+#define WAL_GROUP_WINDOW_US 100
+#define SHARED_STATE_BYTES ((size_t)4 << 30)
+#define SHOW_READ_ATTEMPTS 4
+#define SHOW_WAIT_YIELDS 1024
+#define TRACE_RING_SPANS 65536
@@ -0,0 +1,146 @@
+#include "epoch.h"
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "threadrec.h"
+
+/// Read-side state of one thread. Records are never freed.
+struct EpochRecord {
+  struct ThreadRecord record;
+  uint64_t state;  // Epoch seen on entry shifted left by one, with the low bit set while inside a section
+};
+
+/// Memory waiting for the readers that may see it to leave.
+struct Retired {
+  void *ptr;
+  void (*release)(void *);
+  uint64_t epoch;  // Global epoch when it was retired
+  struct Retired *next;
+};
+
+static uint64_t global_epoch = 1;
+static uint64_t anonymous_readers = 0;  // Readers in a section without a record, which hold back every epoch
+
+static pthread_mutex_t epoch_lock = PTHREAD_MUTEX_INITIALIZER;  // Guards retirement
+static struct Retired *retired = NULL;
+
+static struct ThreadRecords records = THREAD_RECORDS_INITIALIZER(struct EpochRecord);
+static _Thread_local struct EpochRecord *local = NULL;
+static _Thread_local unsigned int depth = 0;  // Sections the calling thread is in
+
+/// Gets the record of the calling thread, claiming one on first use.
+/// @return The record, NULL if memory ran out.
+static struct EpochRecord *thread_record() {
+  if (local == NULL) {
+    local = (struct EpochRecord *)thread_record_claim(&records);
+  }
+
+  return local;
+}
+
+void epoch_enter() {
+  if (depth++ > 0) {
+    return;
+  }
+
+  struct EpochRecord *record = thread_record();
+
+  if (record == NULL) {
+    __atomic_add_fetch(&anonymous_readers, 1, __ATOMIC_SEQ_CST);
+    return;
+  }
+
+  uint64_t epoch = __atomic_load_n(&global_epoch, __ATOMIC_SEQ_CST);
+  __atomic_store_n(&record->state, (epoch << 1) | 1, __ATOMIC_SEQ_CST);
+}
+
+void epoch_exit() {
+  if (--depth > 0) {
+    return;
+  }
+
+  if (local == NULL) {
+    __atomic_sub_fetch(&anonymous_readers, 1, __ATOMIC_RELEASE);
+    return;
+  }
+
+  __atomic_store_n(&local->state, 0, __ATOMIC_RELEASE);
+}
+
+/// Moves the global epoch forward if every reader inside a section has seen the current one.
+/// @note Called with the epoch lock held.
+/// @return 0 if the epoch moved forward, 1 otherwise.
+static int try_advance() {
+  uint64_t epoch = __atomic_load_n(&global_epoch, __ATOMIC_SEQ_CST);
+
+  if (__atomic_load_n(&anonymous_readers, __ATOMIC_SEQ_CST) != 0) {
+    return 1;
+  }
+
+  for (struct ThreadRecord *record = thread_records_first(&records); record != NULL; record = record->next) {
+    uint64_t state = __atomic_load_n(&((struct EpochRecord *)record)->state, __ATOMIC_SEQ_CST);
+
+    if ((state & 1) && (state >> 1) != epoch) {
+      return 1;
+    }
+  }
+
+  __atomic_store_n(&global_epoch, epoch + 1, __ATOMIC_SEQ_CST);
+  return 0;
+}
+
+void epoch_retire(void *ptr, void (*release)(void *)) {
+  struct Retired *entry = malloc(sizeof(struct Retired));
+
+  // Without an entry the memory cannot be tracked, so it is left to the process instead.
+  if (entry == NULL) {
+    return;
+  }
+
+  pthread_mutex_lock(&epoch_lock);
+
+  entry->ptr = ptr;
+  entry->release = release;
+  entry->epoch = __atomic_load_n(&global_epoch, __ATOMIC_SEQ_CST);
+  entry->next = retired;
+  retired = entry;
+
+  // With no reader left behind, the epoch can move two steps at once and free the memory right away.
+  if (try_advance() == 0) {
+    try_advance();
+  }
+
+  // A reader that saw the memory entered at most at the epoch it was retired in, and holds the
+  // global epoch back from moving two past it until it leaves.
+  uint64_t epoch = __atomic_load_n(&global_epoch, __ATOMIC_SEQ_CST);
+  struct Retired **link = &retired;
+
+  while (*link != NULL) {
+    struct Retired *current = *link;
+
+    if (current->epoch + 2 <= epoch) {
+      *link = current->next;
+      current->release(current->ptr);
+      free(current);
+    } else {
+      link = &current->next;
+    }
+  }
+
+  pthread_mutex_unlock(&epoch_lock);
+}
+
+void epoch_reclaim_all() {
+  pthread_mutex_lock(&epoch_lock);
+
+  while (retired != NULL) {
+    struct Retired *next = retired->next;
+    retired->release(retired->ptr);
+    free(retired);
+    retired = next;
+  }
+
+  pthread_mutex_unlock(&epoch_lock);
+}
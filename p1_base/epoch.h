@@ -0,0 +1,27 @@
+#ifndef EMS_EPOCH_H
+#define EMS_EPOCH_H
+
+/// Epoch-based reclamation for structures read without locks. A writer that unlinks memory retires
+/// it instead of freeing it, and it is freed once every reader that could still see it has left
+/// its read-side section.
+
+/// Enters a read-side section. Memory retired from now on is not freed until epoch_exit.
+/// @note Sections may be nested, in which case only the outermost one counts. They must not wait
+/// on anything a writer may hold.
+void epoch_enter();
+
+/// Leaves the read-side section entered last by the calling thread.
+void epoch_exit();
+
+/// Frees memory once no reader can observe it anymore.
+/// @note Retired memory is checked for every time something is retired, so a few retirements may
+/// linger until the next one or epoch_reclaim_all.
+/// @param ptr Memory no longer reachable by new readers.
+/// @param release Function freeing the memory.
+void epoch_retire(void *ptr, void (*release)(void *));
+
+/// Frees every retired memory at once.
+/// @note Should only be called while no thread is in a read-side section.
+void epoch_reclaim_all();
+
+#endif  // EMS_EPOCH_H
@@ -1,68 +1,769 @@
 #include "eventlist.h"
 
+#include <sched.h>
+#include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
+
+#include "constants.h"
+#include "epoch.h"
+#include "shmem.h"
+#include "snapshot.h"
+
+#define INDEX_INITIAL_CAPACITY 64
+
+/// Bytes of seats handled at once by span_is_free and span_fill. GCC lowers operations on it to
+/// whatever vector instructions the target has, and to plain words where it has none.
+typedef uint64_t SeatVector __attribute__((vector_size(16)));
+
+/// Block holding an event and its list node, followed by its seat locks and its seats.
+struct EventBlock {
+  struct ListNode node;
+  struct Event event;
+};
+
+/// Reservation of one seat of a sparse event.
+struct SparseSeat {
+  size_t key;  // Index of the seat plus one, 0 for an empty slot
+  unsigned int value;
+};
+
+/// Open-addressing hash table of the seats written so far, keyed by seat index.
+struct SparseSeats {
+  size_t capacity;  // Always a power of two
+  size_t count;
+  struct SparseSeat slots[];
+};
+
+/// Open-addressing hash table of the nodes of a list, keyed by event id. Lookups read it without
+/// locks, so it is replaced as a whole when it grows and the old one retired.
+struct EventIndex {
+  size_t capacity;  // Always a power of two
+  struct ListNode* slots[];
+};
+
+/// Gets the block an event was allocated in.
+static struct EventBlock* block_of(struct Event* event) {
+  return (struct EventBlock*)((char*)event - offsetof(struct EventBlock, event));
+}
+
+/// Hashes an event id into a slot of an index with the given capacity (Fibonacci hashing).
+static size_t index_slot(unsigned int event_id, size_t capacity) {
+  return (size_t)(((uint64_t)event_id * 0x9E3779B97F4A7C15ULL) >> 32) & (capacity - 1);
+}
+
+/// Allocates an empty index.
+static struct EventIndex* index_create(size_t capacity) {
+  struct EventIndex* index =
+      (struct EventIndex*)shmem_calloc(1, sizeof(struct EventIndex) + capacity * sizeof(struct ListNode*));
+  if (index) index->capacity = capacity;
+  return index;
+}
+
+/// Places a node in the first free slot of its probe sequence, publishing it to lookups.
+static void index_insert(struct EventIndex* index, struct ListNode* node) {
+  size_t slot = index_slot(node->event->id, index->capacity);
+  while (index->slots[slot] != NULL) {
+    slot = (slot + 1) & (index->capacity - 1);
+  }
+  __atomic_store_n(&index->slots[slot], node, __ATOMIC_RELEASE);
+}
+
+/// Doubles the capacity of the index, rehashing every node.
+/// @note Lookups already in progress may still be reading the old index, so it is retired rather
+/// than freed.
+/// @return 0 if the index was grown successfully, 1 otherwise.
+static int index_grow(struct EventList* list) {
+  struct EventIndex* index = index_create(list->index->capacity * 2);
+  if (!index) return 1;
+
+  for (struct ListNode* current = list->head; current; current = current->next) {
+    index_insert(index, current);
+  }
+
+  struct EventIndex* old = list->index;
+  __atomic_store_n(&list->index, index, __ATOMIC_RELEASE);
+  epoch_retire(old, shmem_free);
+  return 0;
+}
 
 struct EventList* create_list() {
-  struct EventList* list = (struct EventList*)malloc(sizeof(struct EventList));
+  struct EventList* list = (struct EventList*)shmem_calloc(1, sizeof(struct EventList));
   if (!list) return NULL;
   list->head = NULL;
   list->tail = NULL;
+  list->index = index_create(INDEX_INITIAL_CAPACITY);
+  if (!list->index) {
+    shmem_free(list);
+    return NULL;
+  }
+  list->size = 0;
+  list->pending = NULL;
+  shmem_rwlock_init(&list->lock);
+  arena_init(&list->arena);
+  list->snapshot = NULL;
   return list;
 }
 
+/// Initializes the event lock, the sparse lock, the show lock and the seat locks of a new event.
+static void init_event_locks(struct Event* event) {
+  shmem_rwlock_init(&event->lock);
+  shmem_mutex_init(&event->sparse_lock);
+  shmem_mutex_init(&event->show_lock);
+  for (size_t i = 0; i < event->num_seat_locks; i++) {
+    shmem_mutex_init(&event->seat_locks[i]);
+  }
+}
+
+struct Event* create_event(struct EventList* list, unsigned int event_id, size_t num_rows, size_t num_cols) {
+  if (!list) return NULL;
+
+  size_t num_seats = num_rows * num_cols;
+  size_t num_seat_locks = num_seats < SEAT_LOCK_STRIPES ? num_seats : SEAT_LOCK_STRIPES;
+  if (num_seat_locks == 0) num_seat_locks = 1;
+
+  size_t words_per_row = (num_cols + 63) / 64;
+
+  size_t locks_offset = sizeof(struct EventBlock);
+  size_t row_free_offset = locks_offset + num_seat_locks * sizeof(pthread_mutex_t);
+  size_t occupied_offset = row_free_offset + num_rows * sizeof(size_t);
+  size_t array_offset = occupied_offset + num_rows * words_per_row * sizeof(uint64_t);
+  size_t data_offset = array_offset + sizeof(struct SeatArray);
+  int sparse = num_seats >= SPARSE_MIN_SEATS;
+
+  // The arena hands out zeroed memory, so every seat starts free.
+  char* block = (char*)arena_alloc(&list->arena, sparse ? array_offset : data_offset + num_seats);
+  if (!block) return NULL;
+
+  struct Event* event = &((struct EventBlock*)block)->event;
+  event->id = event_id;
+  event->rows = num_rows;
+  event->cols = num_cols;
+  event->reservations = 0;
+  event->data = NULL;
+  event->seat_width = 1;
+  event->widening = 0;
+  event->sparse = NULL;
+  event->version = 0;
+  event->writes = 0;
+  event->cached_show = NULL;
+  event->seat_locks = (pthread_mutex_t*)(block + locks_offset);
+  event->num_seat_locks = num_seat_locks;
+  event->occupied = (uint64_t*)(block + occupied_offset);
+  event->words_per_row = words_per_row;
+  event->row_free = (size_t*)(block + row_free_offset);
+  event->free_seats = num_seats;
+
+  for (size_t i = 0; i < num_rows; i++) {
+    event->row_free[i] = num_cols;
+  }
+
+  if (!sparse) {
+    event->data = (struct SeatArray*)(block + array_offset);
+    event->data->width = 1;
+    event->data->allocated = 0;
+    event->data->seats = block + data_offset;
+  }
+
+  init_event_locks(event);
+  return event;
+}
+
+struct Event* map_event(struct EventList* list, unsigned int event_id, size_t num_rows, size_t num_cols,
+                        unsigned int reservations, unsigned int* data, uint64_t* occupied, size_t* row_free,
+                        size_t free_seats) {
+  if (!list) return NULL;
+
+  size_t num_seats = num_rows * num_cols;
+  size_t num_seat_locks = num_seats < SEAT_LOCK_STRIPES ? num_seats : SEAT_LOCK_STRIPES;
+  if (num_seat_locks == 0) num_seat_locks = 1;
+
+  size_t array_offset = sizeof(struct EventBlock) + num_seat_locks * sizeof(pthread_mutex_t);
+  char* block = (char*)arena_alloc(&list->arena, array_offset + sizeof(struct SeatArray));
+  if (!block) return NULL;
+
+  struct Event* event = &((struct EventBlock*)block)->event;
+  event->id = event_id;
+  event->rows = num_rows;
+  event->cols = num_cols;
+  event->reservations = reservations;
+  event->data = (struct SeatArray*)(block + array_offset);
+  event->data->width = sizeof(unsigned int);
+  event->data->allocated = 0;
+  event->data->seats = data;
+  event->seat_width = sizeof(unsigned int);
+  event->widening = 0;
+  event->sparse = NULL;
+  event->version = 0;
+  event->writes = 0;
+  event->cached_show = NULL;
+  event->seat_locks = (pthread_mutex_t*)(block + sizeof(struct EventBlock));
+  event->num_seat_locks = num_seat_locks;
+  event->occupied = occupied;
+  event->words_per_row = (num_cols + 63) / 64;
+  event->row_free = row_free;
+  event->free_seats = free_seats;
+
+  init_event_locks(event);
+  return event;
+}
+
+/// Allocates a seat array with every seat free, apart from the event so that it can be freed once
+/// outgrown.
+/// @return The array, NULL if memory ran out.
+static struct SeatArray* array_create(size_t num_seats, unsigned int width) {
+  char* block = (char*)shmem_calloc(1, sizeof(struct SeatArray) + num_seats * width);
+  if (!block) return NULL;
+
+  struct SeatArray* array = (struct SeatArray*)block;
+  array->width = width;
+  array->allocated = 1;
+  array->seats = block + sizeof(struct SeatArray);
+  return array;
+}
+
+/// Frees a seat array once no reader can still be using it.
+static void array_retire(struct SeatArray* array) {
+  if (array->allocated) epoch_retire(array, shmem_free);
+}
+
+/// Reads a seat of a seat array.
+static unsigned int array_get(const struct SeatArray* array, size_t index) {
+  switch (array->width) {
+    case 1:
+      return __atomic_load_n((uint8_t*)array->seats + index, __ATOMIC_ACQUIRE);
+    case 2:
+      return __atomic_load_n((uint16_t*)array->seats + index, __ATOMIC_ACQUIRE);
+    default:
+      return __atomic_load_n((unsigned int*)array->seats + index, __ATOMIC_ACQUIRE);
+  }
+}
+
+/// Writes a seat of a seat array.
+/// @note The value must fit in the width of the array.
+static void array_set(const struct SeatArray* array, size_t index, unsigned int value) {
+  switch (array->width) {
+    case 1:
+      __atomic_store_n((uint8_t*)array->seats + index, (uint8_t)value, __ATOMIC_RELEASE);
+      break;
+    case 2:
+      __atomic_store_n((uint16_t*)array->seats + index, (uint16_t)value, __ATOMIC_RELEASE);
+      break;
+    default:
+      __atomic_store_n((unsigned int*)array->seats + index, value, __ATOMIC_RELEASE);
+      break;
+  }
+}
+
+/// Writes a seat of a seat array if it is free.
+/// @note The value must fit in the width of the array.
+/// @return 0 if the seat was claimed, 1 if it was taken.
+static int array_claim(const struct SeatArray* array, size_t index, unsigned int value) {
+  switch (array->width) {
+    case 1: {
+      uint8_t expected = 0;
+      return !__atomic_compare_exchange_n((uint8_t*)array->seats + index, &expected, (uint8_t)value, 0,
+                                          __ATOMIC_ACQ_REL, __ATOMIC_RELAXED);
+    }
+    case 2: {
+      uint16_t expected = 0;
+      return !__atomic_compare_exchange_n((uint16_t*)array->seats + index, &expected, (uint16_t)value, 0,
+                                          __ATOMIC_ACQ_REL, __ATOMIC_RELAXED);
+    }
+    default: {
+      unsigned int expected = 0;
+      return !__atomic_compare_exchange_n((unsigned int*)array->seats + index, &expected, value, 0,
+                                          __ATOMIC_ACQ_REL, __ATOMIC_RELAXED);
+    }
+  }
+}
+
+/// Gets the number of bytes per seat a reservation id needs.
+static unsigned int width_for(unsigned int value) {
+  if (value <= UINT8_MAX) return 1;
+  if (value <= UINT16_MAX) return 2;
+  return sizeof(unsigned int);
+}
+
+/// Hashes a seat index into a slot of a sparse table with the given capacity.
+static size_t sparse_slot(size_t index, size_t capacity) {
+  return (size_t)(((uint64_t)index * 0x9E3779B97F4A7C15ULL) >> 32) & (capacity - 1);
+}
+
+/// Finds the slot of a seat in a sparse table, or the empty slot where it belongs.
+static struct SparseSeat* sparse_find(struct SparseSeats* sparse, size_t index) {
+  size_t slot = sparse_slot(index, sparse->capacity);
+  while (sparse->slots[slot].key != 0 && sparse->slots[slot].key != index + 1) {
+    slot = (slot + 1) & (sparse->capacity - 1);
+  }
+  return &sparse->slots[slot];
+}
+
+/// Moves the seats of a sparse event to a seat array, which readers switch to once it is published.
+/// @note Called with the sparse lock of the event held.
+/// @return 0 if the event is now dense, 1 if memory ran out.
+static int promote_to_dense(struct Event* event) {
+  struct SeatArray* data = array_create(event->rows * event->cols, event->seat_width);
+  if (!data) return 1;
+
+  if (event->sparse) {
+    for (size_t i = 0; i < event->sparse->capacity; i++) {
+      struct SparseSeat* seat = &event->sparse->slots[i];
+      if (seat->key != 0) array_set(data, seat->key - 1, seat->value);
+    }
+  }
+
+  __atomic_store_n(&event->data, data, __ATOMIC_RELEASE);
+  if (event->sparse) epoch_retire(event->sparse, shmem_free);
+  event->sparse = NULL;
+  return 0;
+}
+
+/// Gets the slot of a seat of a sparse event, adding it if needed.
+/// @note Called with the sparse lock of the event held and data still NULL.
+/// @return The slot, NULL if memory ran out or the event became dense instead.
+static struct SparseSeat* sparse_insert(struct Event* event, size_t index) {
+  struct SparseSeats* sparse = event->sparse;
+
+  if (sparse) {
+    struct SparseSeat* seat = sparse_find(sparse, index);
+    if (seat->key != 0) return seat;
+  }
+
+  // Past the threshold a seat array takes less memory than the table.
+  size_t count = sparse ? sparse->count : 0;
+  if ((count + 1) * 100 > event->rows * event->cols * SPARSE_PROMOTE_PERCENT) {
+    promote_to_dense(event);
+    return NULL;
+  }
+
+  if (!sparse || (sparse->count + 1) * 2 > sparse->capacity) {
+    size_t capacity = sparse ? sparse->capacity * 2 : 16;
+    struct SparseSeats* grown =
+        (struct SparseSeats*)shmem_calloc(1, sizeof(struct SparseSeats) + capacity * sizeof(struct SparseSeat));
+    if (!grown) return NULL;
+
+    grown->capacity = capacity;
+    grown->count = 0;
+    for (size_t i = 0; sparse && i < sparse->capacity; i++) {
+      if (sparse->slots[i].key != 0) {
+        *sparse_find(grown, sparse->slots[i].key - 1) = sparse->slots[i];
+        grown->count++;
+      }
+    }
+
+    event->sparse = grown;
+    if (sparse) epoch_retire(sparse, shmem_free);
+    sparse = grown;
+  }
+
+  struct SparseSeat* seat = sparse_find(sparse, index);
+  seat->key = index + 1;
+  seat->value = 0;
+  sparse->count++;
+  return seat;
+}
+
+unsigned int seat_get(struct Event* event, size_t index) {
+  unsigned int value = 0;
+
+  epoch_enter();
+
+  struct SeatArray* data = __atomic_load_n(&event->data, __ATOMIC_ACQUIRE);
+  if (data) {
+    value = array_get(data, index);
+  } else {
+    pthread_mutex_lock(&event->sparse_lock);
+    if (event->data) {
+      value = array_get(event->data, index);
+    } else if (event->sparse) {
+      value = sparse_find(event->sparse, index)->value;
+    }
+    pthread_mutex_unlock(&event->sparse_lock);
+  }
+
+  epoch_exit();
+  return value;
+}
+
+int seat_set(struct Event* event, size_t index, unsigned int value) {
+  struct SeatArray* data = __atomic_load_n(&event->data, __ATOMIC_ACQUIRE);
+  if (data) {
+    array_set(data, index, value);
+    return 0;
+  }
+
+  int result = 0;
+
+  pthread_mutex_lock(&event->sparse_lock);
+  struct SparseSeat* seat = event->data ? NULL : sparse_insert(event, index);
+  if (seat) {
+    seat->value = value;
+  } else if (event->data) {
+    array_set(event->data, index, value);
+  } else {
+    result = 1;
+  }
+  pthread_mutex_unlock(&event->sparse_lock);
+
+  return result;
+}
+
+int seat_claim(struct Event* event, size_t index, unsigned int value) {
+  struct SeatArray* data = __atomic_load_n(&event->data, __ATOMIC_ACQUIRE);
+
+  if (data) {
+    return array_claim(data, index, value);
+  }
+
+  int result;
+
+  pthread_mutex_lock(&event->sparse_lock);
+  struct SparseSeat* seat = event->data ? NULL : sparse_insert(event, index);
+  if (seat) {
+    result = seat->value != 0;
+    if (!result) seat->value = value;
+  } else if (event->data) {
+    result = array_claim(event->data, index, value);
+  } else {
+    result = -1;
+  }
+  pthread_mutex_unlock(&event->sparse_lock);
+
+  return result;
+}
+
+void mark_seats_reserved(struct Event* event, const size_t* seats, size_t num_seats) {
+  for (size_t i = 0; i < num_seats; i++) {
+    size_t row = seats[i] / event->cols;
+    size_t col = seats[i] % event->cols;
+
+    __atomic_fetch_or(&event->occupied[row * event->words_per_row + col / 64], 1ULL << (col % 64), __ATOMIC_RELAXED);
+    __atomic_fetch_sub(&event->row_free[row], 1, __ATOMIC_RELAXED);
+  }
+
+  __atomic_fetch_sub(&event->free_seats, num_seats, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&event->version, 1, __ATOMIC_RELEASE);
+}
+
+void mark_seats_free(struct Event* event, const size_t* seats, size_t num_seats) {
+  for (size_t i = 0; i < num_seats; i++) {
+    size_t row = seats[i] / event->cols;
+    size_t col = seats[i] % event->cols;
+
+    __atomic_fetch_and(&event->occupied[row * event->words_per_row + col / 64], ~(1ULL << (col % 64)),
+                       __ATOMIC_RELAXED);
+    __atomic_fetch_add(&event->row_free[row], 1, __ATOMIC_RELAXED);
+  }
+
+  __atomic_fetch_add(&event->free_seats, num_seats, __ATOMIC_RELAXED);
+}
+
+int span_is_free(struct Event* event, size_t first, size_t count) {
+  const struct SeatArray* data = __atomic_load_n(&event->data, __ATOMIC_ACQUIRE);
+  const unsigned char* bytes = (const unsigned char*)data->seats + first * data->width;
+  size_t len = count * data->width;
+  SeatVector taken = {0};
+  size_t i = 0;
+
+  // Seats are only compared with zero, so they are looked at as bytes whatever their width, and
+  // one test at the end covers every vector.
+  for (; i + sizeof(SeatVector) <= len; i += sizeof(SeatVector)) {
+    SeatVector vector;
+    memcpy(&vector, bytes + i, sizeof(vector));
+    taken |= vector;
+  }
+
+  uint64_t any = taken[0] | taken[1];
+  for (; i < len; i++) {
+    any |= bytes[i];
+  }
+
+  return any == 0;
+}
+
+void span_fill(struct Event* event, size_t first, size_t count, unsigned int value) {
+  const struct SeatArray* data = __atomic_load_n(&event->data, __ATOMIC_ACQUIRE);
+  unsigned char* bytes = (unsigned char*)data->seats + first * data->width;
+  size_t len = count * data->width;
+  uint8_t seat8 = (uint8_t)value;
+  uint16_t seat16 = (uint16_t)value;
+  const void* seat = data->width == 1 ? (const void*)&seat8 : data->width == 2 ? (const void*)&seat16 : &value;
+
+  // Every width divides the vector size, so the vector repeats the seat and can be stored at the
+  // start of any seat, the tail included.
+  SeatVector vector;
+  for (size_t i = 0; i < sizeof(vector); i += data->width) {
+    memcpy((unsigned char*)&vector + i, seat, data->width);
+  }
+
+  size_t i = 0;
+  for (; i + sizeof(SeatVector) <= len; i += sizeof(SeatVector)) {
+    memcpy(bytes + i, &vector, sizeof(vector));
+  }
+  memcpy(bytes + i, &vector, len - i);
+}
+
+void mark_block_reserved(struct Event* event, size_t first_row, size_t first_col, size_t num_rows, size_t num_cols) {
+  size_t last_col = first_col + num_cols - 1;
+
+  for (size_t row = first_row; row < first_row + num_rows; row++) {
+    uint64_t* words = event->occupied + row * event->words_per_row;
+
+    for (size_t w = first_col / 64; w <= last_col / 64; w++) {
+      size_t from = w == first_col / 64 ? first_col % 64 : 0;
+      size_t to = w == last_col / 64 ? last_col % 64 : 63;
+      uint64_t mask = (~0ULL >> (63 - to)) & (~0ULL << from);
+
+      __atomic_fetch_or(&words[w], mask, __ATOMIC_RELAXED);
+    }
+
+    __atomic_fetch_sub(&event->row_free[row], num_cols, __ATOMIC_RELAXED);
+  }
+
+  __atomic_fetch_sub(&event->free_seats, num_rows * num_cols, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&event->version, 1, __ATOMIC_RELEASE);
+}
+
+#define SEAT_WRITES_STARTED (1ULL << 32)
+#define SEAT_WRITES_ACTIVE (SEAT_WRITES_STARTED - 1)
+
+/// Moves the seats of an event to an array wide enough for a reservation id, or waits for the
+/// reservation already doing so.
+/// @note Called outside of begin_seat_writes and end_seat_writes.
+/// @return 0 if the seats may be wide enough now, 1 if memory ran out.
+static int widen_seats(struct Event* event, unsigned int value) {
+  int expected = 0;
+
+  if (!__atomic_compare_exchange_n(&event->widening, &expected, 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+    while (__atomic_load_n(&event->widening, __ATOMIC_ACQUIRE)) sched_yield();
+    return 0;
+  }
+
+  // Reservations starting from now on see the flag and wait, so once the ones already writing are
+  // done nothing writes the seats until the flag is cleared. Readers may still be using the old
+  // array, so it is retired rather than freed.
+  while (__atomic_load_n(&event->writes, __ATOMIC_SEQ_CST) & SEAT_WRITES_ACTIVE) sched_yield();
+
+  unsigned int width = width_for(value);
+  int result = 0;
+
+  if (width > event->seat_width && event->data != NULL) {
+    struct SeatArray* wider = array_create(event->rows * event->cols, width);
+
+    if (wider) {
+      struct SeatArray* old = event->data;
+      for (size_t i = 0; i < event->rows * event->cols; i++) {
+        array_set(wider, i, array_get(old, i));
+      }
+      __atomic_store_n(&event->data, wider, __ATOMIC_RELEASE);
+      array_retire(old);
+    } else {
+      result = 1;
+    }
+  }
+
+  if (width > event->seat_width && result == 0) {
+    __atomic_store_n(&event->seat_width, width, __ATOMIC_RELAXED);
+  }
+
+  __atomic_store_n(&event->widening, 0, __ATOMIC_RELEASE);
+  return result;
+}
+
+int begin_seat_writes(struct Event* event, unsigned int value) {
+  while (1) {
+    // Also counts as started, so that a reader can tell a write that came and went from none.
+    __atomic_fetch_add(&event->writes, SEAT_WRITES_STARTED + 1, __ATOMIC_SEQ_CST);
+
+    if (!__atomic_load_n(&event->widening, __ATOMIC_SEQ_CST) &&
+        width_for(value) <= __atomic_load_n(&event->seat_width, __ATOMIC_RELAXED)) {
+      return 0;
+    }
+
+    end_seat_writes(event);
+
+    if (widen_seats(event, value) != 0) {
+      return 1;
+    }
+  }
+}
+
+void end_seat_writes(struct Event* event) { __atomic_fetch_sub(&event->writes, 1, __ATOMIC_RELEASE); }
+
+int copy_seats_optimistic(struct Event* event, unsigned int* seats, unsigned int (*read)(struct Event*, size_t)) {
+  // A copy started while a reservation writes seats could never be trusted, so it waits for one
+  // to finish rather than failing right away.
+  uint64_t before = __atomic_load_n(&event->writes, __ATOMIC_ACQUIRE);
+  for (unsigned int yields = 0; before & SEAT_WRITES_ACTIVE; yields++) {
+    if (yields == SHOW_WAIT_YIELDS) return 2;
+    sched_yield();
+    before = __atomic_load_n(&event->writes, __ATOMIC_ACQUIRE);
+  }
+
+  size_t num_seats = event->rows * event->cols;
+  int invalidated = 0;
+  epoch_enter();
+  for (size_t i = 0; i < num_seats && !invalidated; i++) {
+    seats[i] = read(event, i);
+    // Seats are read with acquire semantics, so the check cannot move before the read.
+    invalidated = __atomic_load_n(&event->writes, __ATOMIC_ACQUIRE) != before;
+  }
+  epoch_exit();
+
+  return invalidated;
+}
+
+/// Finds the first seat of a row, at or after a column, that is reserved or, if occupied is 0, free.
+/// @return Column of the seat, cols if there is none.
+static size_t next_seat(const uint64_t* words, size_t cols, size_t from, int occupied) {
+  size_t w = from / 64;
+  uint64_t flip = occupied ? 0 : ~0ULL;
+  uint64_t word = (__atomic_load_n(&words[w], __ATOMIC_RELAXED) ^ flip) & (~0ULL << (from % 64));
+
+  while (word == 0) {
+    if (++w * 64 >= cols) return cols;
+    word = __atomic_load_n(&words[w], __ATOMIC_RELAXED) ^ flip;
+  }
+
+  size_t col = w * 64 + (size_t)__builtin_ctzll(word);
+  return col < cols ? col : cols;
+}
+
+int find_free_seats(struct Event* event, size_t num_seats, size_t* index) {
+  if (num_seats == 0 || num_seats > event->cols) return 1;
+
+  for (size_t row = 0; row < event->rows; row++) {
+    if (__atomic_load_n(&event->row_free[row], __ATOMIC_RELAXED) < num_seats) continue;
+
+    const uint64_t* words = event->occupied + row * event->words_per_row;
+    size_t col = 0;
+
+    // Jump from run to run of free seats instead of looking at every seat.
+    while (col < event->cols) {
+      size_t start = next_seat(words, event->cols, col, 0);
+      if (start == event->cols) break;
+
+      size_t end = next_seat(words, event->cols, start, 1);
+      if (end - start >= num_seats) {
+        *index = row * event->cols + start;
+        return 0;
+      }
+
+      col = end;
+    }
+  }
+
+  return 1;
+}
+
+/// Number of nodes appended to any list so far.
+static uint64_t num_created = 0;
+
 int append_to_list(struct EventList* list, struct Event* event) {
   if (!list) return 1;
 
-  struct ListNode* new_node = (struct ListNode*)malloc(sizeof(struct ListNode));
-  if (!new_node) return 1;
+  // Keep the load factor at or below one half so that probe sequences stay short.
+  if ((list->size + 1) * 2 > list->index->capacity && index_grow(list) != 0) return 1;
+
+  struct ListNode* new_node = &block_of(event)->node;
 
   new_node->event = event;
   new_node->next = NULL;
+  new_node->created = __atomic_add_fetch(&num_created, 1, __ATOMIC_RELAXED);
 
+  // Readers walk the list without the lock, so the node is only linked once it is complete.
   if (list->head == NULL) {
-    list->head = new_node;
-    list->tail = new_node;
+    __atomic_store_n(&list->head, new_node, __ATOMIC_RELEASE);
   } else {
-    list->tail->next = new_node;
-    list->tail = new_node;
+    __atomic_store_n(&list->tail->next, new_node, __ATOMIC_RELEASE);
+  }
+  list->tail = new_node;
+
+  index_insert(list->index, new_node);
+  list->size++;
+
+  return 0;
+}
+
+void add_pending(struct EventList* list, struct Event* event) {
+  struct ListNode* node = &block_of(event)->node;
+  node->event = event;
+  node->next = list->pending;
+  list->pending = node;
+}
+
+void remove_pending(struct EventList* list, struct Event* event) {
+  struct ListNode** link = &list->pending;
+  while (*link && (*link)->event != event) {
+    link = &(*link)->next;
   }
+  if (*link) *link = (*link)->next;
+}
 
+int is_pending(struct EventList* list, unsigned int event_id) {
+  for (struct ListNode* current = list->pending; current; current = current->next) {
+    if (current->event->id == event_id) return 1;
+  }
   return 0;
 }
 
-static void free_event(struct Event* event) {
-  if (!event) return;
+struct ListNode* next_created(struct ListNode** cursors, size_t num_lists) {
+  size_t first = num_lists;
+
+  for (size_t i = 0; i < num_lists; i++) {
+    if (cursors[i] != NULL && (first == num_lists || cursors[i]->created < cursors[first]->created)) {
+      first = i;
+    }
+  }
+
+  if (first == num_lists) {
+    return NULL;
+  }
 
-  free(event->data);
-  free(event);
+  struct ListNode* node = cursors[first];
+  cursors[first] = __atomic_load_n(&node->next, __ATOMIC_ACQUIRE);
+  return node;
 }
 
 void free_list(struct EventList* list) {
   if (!list) return;
 
-  struct ListNode* current = list->head;
-  while (current) {
-    struct ListNode* temp = current;
-    current = current->next;
-
-    free_event(temp->event);
-    free(temp);
+  // Nothing holds the locks of the events by now, so the events are released with the arena
+  // instead of one by one, once the seats they keep outside of it are freed.
+  for (struct ListNode* current = list->head; current; current = current->next) {
+    struct Event* event = current->event;
+    if (event->data && event->data->allocated) shmem_free(event->data);
+    shmem_free(event->sparse);
   }
+  arena_destroy(&list->arena);
+  snapshot_unmap(list->snapshot);
 
-  free(list);
+  epoch_reclaim_all();
+  pthread_rwlock_destroy(&list->lock);
+  shmem_free(list->index);
+  shmem_free(list);
 }
 
 struct Event* get_event(struct EventList* list, unsigned int event_id) {
   if (!list) return NULL;
 
-  struct ListNode* current = list->head;
-  while (current) {
-    struct Event* event = current->event;
-    if (event->id == event_id) {
-      return event;
+  epoch_enter();
+
+  struct EventIndex* index = __atomic_load_n(&list->index, __ATOMIC_ACQUIRE);
+  size_t slot = index_slot(event_id, index->capacity);
+  struct ListNode* node;
+
+  while ((node = __atomic_load_n(&index->slots[slot], __ATOMIC_ACQUIRE)) != NULL) {
+    if (node->event->id == event_id) {
+      epoch_exit();
+      return node->event;
     }
-    current = current->next;
+    slot = (slot + 1) & (index->capacity - 1);
   }
 
-  return NULL;
+  epoch_exit();
+
+  // Events loaded from a snapshot are only set up once they are first looked up.
+  return list->snapshot ? snapshot_get_event(list, event_id) : NULL;
 }
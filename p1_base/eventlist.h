@@ -1,7 +1,24 @@
 #ifndef EVENT_LIST_H
 #define EVENT_LIST_H
 
+#include <pthread.h>
 #include <stddef.h>
+#include <stdint.h>
+
+#include "arena.h"
+
+struct SparseSeats;
+struct CachedShow;
+struct Snapshot;
+struct EventIndex;
+
+/// Seats of a dense event, each as wide as the reservation ids drawn so far need. Never changed
+/// once published; a wider one takes its place instead, and the old one is retired.
+struct SeatArray {
+  unsigned int width;  /// Bytes per seat: 1, 2 or 4.
+  int allocated;       /// Set if allocated on its own rather than along with the event.
+  void* seats;         /// rows * cols seats of width bytes each, in host byte order.
+};
 
 struct Event {
   unsigned int id;            /// Event id
@@ -10,36 +27,221 @@ struct Event {
   size_t cols;  /// Number of columns.
   size_t rows;  /// Number of rows.
 
-  unsigned int* data;  /// Array of size rows * cols with the reservations for each seat.
+  struct SeatArray* data;  /// Reservations for each seat, NULL while sparse.
+  unsigned int seat_width;  /// Bytes per seat of data, or of the array a sparse event will get.
+  int widening;             /// Set while data is being replaced by a wider array.
+
+  struct SparseSeats* sparse;  /// Reservations of the seats written so far, while data is NULL.
+  pthread_mutex_t sparse_lock;  /// Guards sparse and the switch to data.
+
+  uint64_t* occupied;     /// Bitmap of the reserved seats, each row starting on a new word.
+  size_t words_per_row;   /// Number of bitmap words per row.
+  size_t* row_free;       /// Number of free seats in each row.
+  size_t free_seats;      /// Number of free seats in the event.
+
+  pthread_rwlock_t lock;         /// Shared by reservations and SHOW, held exclusively by block reservations.
+  pthread_mutex_t* seat_locks;   /// Seat i is guarded by seat_locks[i % num_seat_locks].
+  size_t num_seat_locks;         /// Number of seat locks, at most SEAT_LOCK_STRIPES.
+
+  unsigned int version;            /// Bumped every time seats change, so cached output can be checked.
+  uint64_t writes;                 /// Reservations writing seats in the low half, started in the high half.
+  struct CachedShow* cached_show;  /// Last rendered SHOW output, changed by the show cache.
+  pthread_mutex_t show_lock;       /// Guards cached_show, so that a cache hit can pin its entry.
 };
 
 struct ListNode {
   struct Event* event;
-  struct ListNode* next;
+  struct ListNode* next;  // Published with release semantics, so readers may follow it without locks
+  uint64_t created;       // Order in which the node was appended, across every list of the process
 };
 
-// Linked list structure
+// Linked list structure, indexed by event id
 struct EventList {
-  struct ListNode* head;  // Head of the list
+  struct ListNode* head;  // Head of the list, published like next
   struct ListNode* tail;  // Tail of the list
+
+  struct EventIndex* index;  // Hash table of the nodes by event id, replaced as a whole when it grows
+  size_t size;               // Number of nodes in the index
+
+  struct ListNode* pending;  // Nodes of the events whose creation is still being logged, chained by next
+
+  pthread_rwlock_t lock;  // Serializes the writers of the list, its index and pending, taken by the callers
+
+  struct Arena arena;  // Holds every event, with its list node, seat locks and seats
+
+  struct Snapshot* snapshot;  // Snapshot the events before head were loaded from, NULL if none
 };
 
+/// Creates a new event with every seat free, allocated from the arena of the list.
+/// @note The event, its list node, its seat locks and its seats are laid out in a single block,
+/// which lives as long as the list whether or not the event is appended to it. Seats start one byte
+/// wide and are widened as reservation ids outgrow them. Events of at least SPARSE_MIN_SEATS seats
+/// start without a seat array, keeping only the seats reserved in a hash table until
+/// SPARSE_PROMOTE_PERCENT of them are.
+/// @param list Event list the event is meant for.
+/// @param event_id Event id.
+/// @param num_rows Number of rows.
+/// @param num_cols Number of columns.
+/// @return Newly created event, NULL on failure
+struct Event* create_event(struct EventList* list, unsigned int event_id, size_t num_rows, size_t num_cols);
+
+/// Creates an event over seats and counts that already exist, such as those of a mapped snapshot.
+/// @note Only the event, its list node and its seat locks are allocated from the arena of the list.
+/// @param list Event list the event is meant for.
+/// @param event_id Event id.
+/// @param num_rows Number of rows.
+/// @param num_cols Number of columns.
+/// @param reservations Number of reservations made so far.
+/// @param data Reservation of each seat, num_rows * num_cols entries of 4 bytes.
+/// @param occupied Occupancy bitmap, num_rows rows of whole words.
+/// @param row_free Number of free seats in each row.
+/// @param free_seats Number of free seats in the event.
+/// @return Newly created event, NULL on failure
+struct Event* map_event(struct EventList* list, unsigned int event_id, size_t num_rows, size_t num_cols,
+                        unsigned int reservations, unsigned int* data, uint64_t* occupied, size_t* row_free,
+                        size_t free_seats);
+
+/// Reads the reservation of a seat, whichever way the seats of the event are stored.
+/// @note Runs in an epoch section, as the seats may move to a wider array meanwhile.
+/// @param event Event the seat belongs to.
+/// @param index Index of the seat.
+/// @return Reservation id of the seat, 0 if it is free.
+unsigned int seat_get(struct Event* event, size_t index);
+
+/// Writes the reservation of a seat.
+/// @note May switch the event from sparse to dense storage. Must be called between
+/// begin_seat_writes and end_seat_writes for a value at least as large.
+/// @param event Event the seat belongs to.
+/// @param index Index of the seat.
+/// @param value Reservation id, 0 to free the seat.
+/// @return 0 if the seat was written, 1 if memory ran out.
+int seat_set(struct Event* event, size_t index, unsigned int value);
+
+/// Atomically writes the reservation of a seat if it is free.
+/// @note Lock-free on dense storage; sparse storage serializes on the sparse lock of the event.
+/// Must be called between begin_seat_writes and end_seat_writes for the same value.
+/// @param event Event the seat belongs to.
+/// @param index Index of the seat.
+/// @param value Reservation id.
+/// @return 0 if the seat was claimed, 1 if it was taken, -1 if memory ran out.
+int seat_claim(struct Event* event, size_t index, unsigned int value);
+
+/// Records seats as reserved in the occupancy bitmap and free seat counts of an event, and bumps
+/// its version.
+/// @note Safe to call concurrently for different seats. Called once the seats hold the reservation.
+/// @param event Event the seats belong to.
+/// @param seats Indices of the seats.
+/// @param num_seats Number of seats.
+void mark_seats_reserved(struct Event* event, const size_t* seats, size_t num_seats);
+
+/// Records seats marked by mark_seats_reserved as free again, when their reservation is taken back.
+/// @note Called while the seats still hold the reservation, so that a reservation claiming them
+/// once they are freed cannot have its bits cleared. The version is left to the caller to bump
+/// once the seats are freed.
+/// @param event Event the seats belong to.
+/// @param seats Indices of the seats.
+/// @param num_seats Number of seats.
+void mark_seats_free(struct Event* event, const size_t* seats, size_t num_seats);
+
+/// Checks whether a run of seats of a dense event is free, several seats at a time.
+/// @note Reads the seats without atomics, so no reservation may write them concurrently.
+/// @param event Event the seats belong to, with data allocated.
+/// @param first Index of the first seat.
+/// @param count Number of seats.
+/// @return 1 if every seat is free, 0 otherwise.
+int span_is_free(struct Event* event, size_t first, size_t count);
+
+/// Writes the same reservation to a run of seats of a dense event, several seats at a time.
+/// @note Writes the seats without atomics, so nothing may read or write them concurrently.
+/// @param event Event the seats belong to, with data allocated.
+/// @param first Index of the first seat.
+/// @param count Number of seats.
+/// @param value Reservation id.
+void span_fill(struct Event* event, size_t first, size_t count, unsigned int value);
+
+/// Records a rectangle of seats as reserved, like mark_seats_reserved, setting the bits of each
+/// row a word at a time.
+/// @param event Event the seats belong to.
+/// @param first_row Row of the top left seat, starting at 0.
+/// @param first_col Column of the top left seat, starting at 0.
+/// @param num_rows Number of rows.
+/// @param num_cols Number of columns.
+void mark_block_reserved(struct Event* event, size_t first_row, size_t first_col, size_t num_rows, size_t num_cols);
+
+/// Marks the start of a reservation that writes seats of an event, so that optimistic readers of
+/// every seat know to retry. Must be paired with end_seat_writes if it succeeds.
+/// @note If the seats are too narrow for the reservation id, waits for the reservations already
+/// writing seats to finish and moves the seats to a wider array first.
+/// @param event Event whose seats are about to be written.
+/// @param value Largest reservation id about to be written.
+/// @return 0 if seats may be written, 1 if memory for a wider array ran out.
+int begin_seat_writes(struct Event* event, unsigned int value);
+
+/// Marks the end of a reservation started with begin_seat_writes.
+/// @param event Event whose seats were written.
+void end_seat_writes(struct Event* event);
+
+/// Copies every seat of an event without taking its lock, as long as no reservation writes seats
+/// while the copy is made. Waits for reservations already writing seats to finish first, and gives
+/// up on the copy as soon as another one starts.
+/// @note The copy is made in a single epoch section, which the reads of seat_get nest in.
+/// @param event Event to copy.
+/// @param seats Buffer of rows * cols entries to copy the seats to.
+/// @param read Function reading one seat, such as seat_get.
+/// @return 0 if the copy is a consistent picture of the event, 1 if a reservation got in the way,
+/// 2 if reservations kept writing seats for SHOW_WAIT_YIELDS yields before the copy could start.
+int copy_seats_optimistic(struct Event* event, unsigned int* seats, unsigned int (*read)(struct Event*, size_t));
+
+/// Finds the first run of adjacent free seats in a row of an event, scanning its occupancy bitmap
+/// a word at a time.
+/// @param event Event to search.
+/// @param num_seats Length of the run.
+/// @param index Pointer to the variable to store the index of the first seat of the run in.
+/// @return 0 if a run was found, 1 otherwise.
+int find_free_seats(struct Event* event, size_t num_seats, size_t* index);
+
 /// Creates a new event list.
 /// @return Newly created event list, NULL on failure
 struct EventList* create_list();
 
-/// Appends a new node to the list.
+/// Appends an event to the list and indexes it, growing the index when it gets too full.
 /// @param list Event list to be modified.
-/// @param data Event to be stored in the new node.
+/// @param data Event created by create_event for this list.
 /// @return 0 if the node was appended successfully, 1 otherwise.
 int append_to_list(struct EventList* list, struct Event* data);
 
-/// Removes a node from the list.
-/// @param list Event list to be modified.
-/// @return 0 if the node was removed successfully, 1 otherwise.
+/// Holds the id of an event whose creation is being logged, without making the event visible to
+/// get_event, so that the list lock need not be held until the event can be appended.
+/// @param list Event list the event was created for.
+/// @param event Event created by create_event for this list.
+void add_pending(struct EventList* list, struct Event* event);
+
+/// Releases the id held by add_pending, before the event is appended or given up on.
+/// @param list Event list the event was created for.
+/// @param event Event passed to add_pending.
+void remove_pending(struct EventList* list, struct Event* event);
+
+/// Checks whether an event id is held by add_pending.
+/// @param list Event list to be searched.
+/// @param event_id Event id.
+/// @return 1 if the id is held, 0 otherwise.
+int is_pending(struct EventList* list, unsigned int event_id);
+
+/// Takes the node appended first among the nodes several lists are at, so that walking them this
+/// way visits the events of every list in the order they were created.
+/// @note Safe to call without the list locks, like get_event.
+/// @param cursors Node each list is at, NULL once it is done, starting at their heads. The cursor
+/// of the list the node is taken from moves on to the next node.
+/// @param num_lists Number of lists.
+/// @return The node, NULL once every list is done.
+struct ListNode* next_created(struct ListNode** cursors, size_t num_lists);
+
+/// Frees the list and every event created for it.
+/// @param list Event list to be freed.
 void free_list(struct EventList* list);
 
 /// Retrieves an event in the list.
+/// @note Safe to call without the list lock, concurrently with appends. Events of a mapped snapshot are set up the first time they are looked up.
 /// @param list Event list to be searched
 /// @param event_id Event id.
 /// @return Pointer to the event if found, NULL otherwise.
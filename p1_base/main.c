@@ -3,194 +3,789 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <dirent.h>
+#include <errno.h>
 #include <fcntl.h>
+#include <pthread.h>
 #include <string.h>
+#include <sys/wait.h>
 
+#include "command.h"
+#include "compiler.h"
 #include "constants.h"
 #include "operations.h"
 #include "parser.h"
+#include "pipeline.h"
+#include "server.h"
+#include "shards.h"
+#include "shmem.h"
+#include "stats.h"
+#include "trace.h"
+#include "watch.h"
+
+/// Directory being processed, shared by the job workers.
+struct JobsDir {
+  DIR *dir;
+  const char *path;
+  pthread_mutex_t lock;  // readdir is not safe to call concurrently on the same stream
+};
+
+/// Job file shared by the threads executing it.
+struct JobFile {
+  const char *path;
+  int fdOut;
+  unsigned int num_threads;
+  pthread_barrier_t barrier;  // Where every thread meets on BARRIER
+};
+
+/// Job file being executed by a forked worker process.
+struct JobChild {
+  pid_t pid;
+  char path[PATH_MAX];
+};
+
+/// One of the threads executing a job file.
+struct JobThread {
+  struct JobFile *file;
+  unsigned int thread_id;  // 1-based, as used by WAIT
+};
+
+/// Ways a job file can be executed.
+enum ExecMode {
+  EXEC_THREADS,  /// Every thread reads the file and runs its share of the commands.
+  EXEC_SHARDED,  /// The file is read once and each command is run by the shard owning its event.
+  EXEC_PIPELINE  /// Parsing, execution and output of the file run as three stages on their own threads.
+};
+
+static unsigned int max_threads = DEFAULT_MAX_THREADS;
+static enum ExecMode exec_mode = EXEC_THREADS;
+
+int readFile(int fd, int fdOut, unsigned int thread_id, unsigned int num_threads, pthread_barrier_t *barrier);
+
+static void usage(const char *prog) {
+  fprintf(stderr, "Usage: %s [-p max_proc] [-t max_threads] [-m threads|sharded|pipeline] [-e locked|lockfree] [-k show_cache_bytes] [-L log_file [-g window_us]] [-z snapshot] [-Z snapshot] [-s stats_file] [-T trace_file] [-w] <jobs_dir> [delay_ms]\n", prog);
+  fprintf(stderr, "       %s -f [-p max_proc] [-t max_threads] [-m threads|sharded|pipeline] [-e locked|lockfree] [-Z snapshot] <jobs_dir> [delay_ms]\n", prog);
+  fprintf(stderr, "       %s -r <register_pipe> [-n max_sessions] [-e locked|lockfree] [-k show_cache_bytes] [-L log_file [-g window_us]] [-z snapshot] [-Z snapshot] [-s stats_file] [-T trace_file] [delay_ms]\n", prog);
+  fprintf(stderr, "       %s -c <input.jobs> <output.jobs>\n", prog);
+}
 
-int readFile(int fd, int fdOut);
+/// Compiles a text job file into a binary one, which is executed like any other job file.
+/// @param path Path of the text job file.
+/// @param out_path Path of the compiled job file.
+/// @return 0 if the file was compiled successfully, 1 otherwise.
+static int compile_file(const char *path, const char *out_path) {
+  int fd = open(path, O_RDONLY);
 
-int main(int argc, char *argv[]) {
+  if (fd < 0) {
+    perror("Failed to open job file");
+    return 1;
+  }
 
-  unsigned int state_access_delay_ms = STATE_ACCESS_DELAY_MS;
-  DIR *dir;
-  struct dirent *dp;
-  int fd, fdOut;
-  char path[128];
-  char out_filepath[128];
+  int fdOut = open(out_path, O_CREAT | O_TRUNC | O_WRONLY, S_IRUSR | S_IWUSR);
 
-  if (argc < 2) {
+  if (fdOut < 0) {
+    perror("Failed to open output file");
+    close(fd);
+    return 1;
+  }
 
-    fprintf(stderr, "Not enough arguments\n");
+  int result = compile_jobs(fd, fdOut);
+
+  if (result != 0) {
+    fprintf(stderr, "Failed to compile job file\n");
+  }
+
+  parser_release(fd);
+  close(fd);
+  close(fdOut);
+  return result;
+}
+
+/// Parses an unsigned integer command line argument.
+/// @param arg Argument to parse.
+/// @param value Pointer to the variable to store the value in.
+/// @return 0 if the argument was parsed successfully, 1 otherwise.
+static int parse_uint_arg(const char *arg, unsigned int *value) {
+  char *endptr;
+  unsigned long int ul = strtoul(arg, &endptr, 10);
+
+  if (*arg == '\0' || *endptr != '\0' || ul > UINT_MAX) {
     return 1;
-    
   }
 
-  else if (argc > 2) {
+  *value = (unsigned int)ul;
+  return 0;
+}
+
+/// Takes the next job file from the directory.
+/// @param jobs Directory being processed.
+/// @param path Buffer to store the path of the job file in.
+/// @param out_filepath Buffer to store the path of the output file in.
+/// @return 0 if a job file was found, 1 once the directory is exhausted.
+static int next_job(struct JobsDir *jobs, char *path, char *out_filepath) {
+  struct dirent *dp;
 
-    char *endptr;
-    unsigned long int delay = strtoul(argv[2], &endptr, 10);
+  pthread_mutex_lock(&jobs->lock);
 
-    if (*endptr != '\0' || delay > UINT_MAX) {
-      fprintf(stderr, "Invalid delay value or value too large\n");
+  for (;;) {
+    dp = readdir(jobs->dir);
+
+    if (dp == NULL) {
+      pthread_mutex_unlock(&jobs->lock);
       return 1;
     }
 
-    state_access_delay_ms = (unsigned int)delay;
+    if (strcmp(dp->d_name, ".") == 0 || strcmp(dp->d_name, "..") == 0) {
+      continue;
+    }
+
+    if (strstr(dp->d_name, ".jobs") == NULL) {
+      continue;
+    }
+
+    break;
   }
 
-  dir = opendir(argv[1]);
+  printf("%s\n", dp->d_name);
 
+  snprintf(path, PATH_MAX, "%s/%s", jobs->path, dp->d_name);
+  pthread_mutex_unlock(&jobs->lock);
 
-  if (dir == NULL){
+  strcpy(out_filepath, path);
+  strcpy(strrchr(out_filepath, '.'), ".out");
 
-    perror("No such folder");
-    exit(1);
-  }
+  return 0;
+}
 
-  if (ems_init(state_access_delay_ms)) {
-    fprintf(stderr, "Failed to initialize EMS\n");
-    return 1;
+/// Executes a job file as one of its threads. Every thread reads the whole file through its own
+/// descriptor and runs the commands assigned to it.
+/// @param arg Thread executing the job file.
+static void *job_thread(void *arg) {
+  struct JobThread *thread = (struct JobThread *)arg;
+  struct JobFile *file = thread->file;
+
+  int fd = open(file->path, O_RDONLY);
+
+  if (fd < 0) {
+    perror("Failed to open job file");
+    return NULL;
   }
 
-  for(;;){
+  readFile(fd, file->fdOut, thread->thread_id, file->num_threads, file->num_threads > 1 ? &file->barrier : NULL);
+
+  parser_release(fd);
+  close(fd);
+  return NULL;
+}
 
-    strcpy(path, argv[1]);
-    strcat(path, "/");
+/// Executes a job file with up to max_threads threads.
+/// @param path Path of the job file.
+/// @param out_filepath Path of the output file.
+static void run_job_file(const char *path, const char *out_filepath) {
+  struct JobFile file = {.path = path, .num_threads = max_threads};
+  uint64_t start = stats_start();
 
-    dp = readdir(dir);
+  file.fdOut = open(out_filepath, O_CREAT | O_TRUNC | O_WRONLY, S_IRUSR | S_IWUSR);
 
-    if(dp == NULL){
-      break;
+  if (file.fdOut < 0) {
+    perror("Failed to open output file");
+    return;
+  }
+
+  if (exec_mode != EXEC_THREADS) {
+    int fd = open(path, O_RDONLY);
+
+    if (fd < 0) {
+      perror("Failed to open job file");
+    } else {
+      if (exec_mode == EXEC_SHARDED) {
+        shards_run_file(fd, file.fdOut);
+      } else {
+        pipeline_run_file(fd, file.fdOut);
+      }
+
+      parser_release(fd);
+      close(fd);
     }
 
-    if (strcmp(dp->d_name, ".") == 0 || strcmp(dp->d_name, "..") == 0){
-      continue;
+    close(file.fdOut);
+    stats_record_file(path, start);
+    return;
+  }
+
+  if (file.num_threads == 1) {
+    struct JobThread thread = {.file = &file, .thread_id = 1};
+    job_thread(&thread);
+    close(file.fdOut);
+    stats_record_file(path, start);
+    return;
+  }
+
+  pthread_t *tids = malloc(file.num_threads * sizeof(pthread_t));
+  struct JobThread *threads = malloc(file.num_threads * sizeof(struct JobThread));
+
+  if (tids == NULL || threads == NULL) {
+    fprintf(stderr, "Error allocating memory for job threads\n");
+    free(tids);
+    free(threads);
+    close(file.fdOut);
+    return;
+  }
+
+  pthread_barrier_init(&file.barrier, NULL, file.num_threads);
+
+  // A thread that cannot be created would leave the others stuck on the barrier, so every
+  // thread is required.
+  unsigned int started = 0;
+  for (; started < file.num_threads; started++) {
+    threads[started].file = &file;
+    threads[started].thread_id = started + 1;
+
+    if (pthread_create(&tids[started], NULL, job_thread, &threads[started]) != 0) {
+      fprintf(stderr, "Failed to create job thread\n");
+      exit(1);
     }
+  }
 
-    if (strstr(dp->d_name, ".jobs") == NULL) {
+  for (unsigned int i = 0; i < started; i++) {
+    pthread_join(tids[i], NULL);
+  }
 
-      continue;
+  pthread_barrier_destroy(&file.barrier);
+  free(threads);
+  free(tids);
+  close(file.fdOut);
+  stats_record_file(path, start);
+}
+
+/// Processes job files until the directory is exhausted.
+/// @param arg Directory being processed.
+static void *job_worker(void *arg) {
+  struct JobsDir *jobs = (struct JobsDir *)arg;
+  char path[PATH_MAX];
+  char out_filepath[PATH_MAX];
+
+  while (next_job(jobs, path, out_filepath) == 0) {
+    run_job_file(path, out_filepath);
+  }
+
+  return NULL;
+}
+
+/// Processes every job file of the directory with up to max_proc workers.
+/// @param jobs Directory being processed.
+/// @param max_proc Number of job files processed at the same time.
+/// @return 0 if the directory was processed, 1 otherwise.
+static int run_jobs_dir(struct JobsDir *jobs, unsigned int max_proc) {
+  pthread_t *workers = malloc(max_proc * sizeof(pthread_t));
+
+  if (workers == NULL) {
+    fprintf(stderr, "Error allocating memory for workers\n");
+    return 1;
+  }
+
+  pthread_mutex_init(&jobs->lock, NULL);
+
+  unsigned int started = 0;
+  for (; started < max_proc; started++) {
+    if (pthread_create(&workers[started], NULL, job_worker, jobs) != 0) {
+      fprintf(stderr, "Failed to create worker thread\n");
+      break;
     }
+  }
 
-    printf("%s\n", dp -> d_name);
+  // Fall back to the main thread if no worker could be started.
+  if (started == 0) {
+    job_worker(jobs);
+  }
 
-    strcat(path, dp -> d_name);
+  for (unsigned int i = 0; i < started; i++) {
+    pthread_join(workers[i], NULL);
+  }
 
-    strcpy(out_filepath, path);
+  free(workers);
+  pthread_mutex_destroy(&jobs->lock);
+  return 0;
+}
 
-    strcpy(strrchr(out_filepath, '.'), ".out");
+/// Executes a job file in a forked worker process, then exits it.
+/// @param path Path of the job file.
+/// @param out_filepath Path of the output file.
+static void job_child(const char *path, const char *out_filepath) {
+  // Threads are not inherited across fork, so every process runs its own shards.
+  if (exec_mode == EXEC_SHARDED && shards_init(max_threads) != 0) {
+    fprintf(stderr, "Failed to start shards\n");
+    _exit(1);
+  }
 
-    fd = open(path, O_RDONLY);
+  run_job_file(path, out_filepath);
 
-    
+  if (exec_mode == EXEC_SHARDED) {
+    shards_terminate();
+  }
+
+  fflush(stdout);
+  _exit(0);
+}
 
-    fdOut = open(out_filepath, O_CREAT| O_TRUNC | O_WRONLY, S_IRUSR | S_IWUSR);
+/// Waits for one of the worker processes and reports how it ended.
+/// @param children Worker processes still running, the one waited for is removed.
+/// @param num_children Number of worker processes still running.
+/// @return 0 if the process exited successfully, 1 otherwise.
+static int reap_child(struct JobChild *children, unsigned int *num_children) {
+  int status;
+  pid_t pid;
+
+  while ((pid = wait(&status)) < 0) {
+    if (errno != EINTR) {
+      perror("Failed to wait for worker process");
+      *num_children = 0;
+      return 1;
+    }
+  }
 
-    readFile(fd, fdOut);
+  unsigned int i = 0;
+  while (i < *num_children && children[i].pid != pid) {
+    i++;
   }
 
-  ems_terminate();
-  closedir(dir);
+  if (i == *num_children) {
+    return 0;
+  }
+
+  if (WIFEXITED(status)) {
+    printf("%s: worker %d exited with status %d\n", children[i].path, (int)pid, WEXITSTATUS(status));
+  } else {
+    printf("%s: worker %d killed by signal %d\n", children[i].path, (int)pid, WTERMSIG(status));
+  }
+
+  children[i] = children[--*num_children];
+  return !WIFEXITED(status) || WEXITSTATUS(status) != 0;
 }
 
+/// Processes every job file of the directory in up to max_proc forked worker processes, so that
+/// a job file that crashes only takes its own process down.
+/// @note The event state must live in shared memory, see shmem_init.
+/// @param jobs Directory being processed.
+/// @param max_proc Number of worker processes running at the same time.
+/// @return 0 if every worker process exited successfully, 1 otherwise.
+static int run_jobs_forked(struct JobsDir *jobs, unsigned int max_proc) {
+  struct JobChild *children = malloc(max_proc * sizeof(struct JobChild));
+
+  if (children == NULL) {
+    fprintf(stderr, "Error allocating memory for workers\n");
+    return 1;
+  }
 
-  
-int readFile(int fd, int fdOut){
+  pthread_mutex_init(&jobs->lock, NULL);
 
-  while (1) {
-    unsigned int event_id, delay;
-    size_t num_rows, num_columns, num_coords;
-    size_t xs[MAX_RESERVATION_SIZE], ys[MAX_RESERVATION_SIZE];
+  unsigned int num_children = 0;
+  int result = 0;
+  char path[PATH_MAX];
+  char out_filepath[PATH_MAX];
 
+  while (next_job(jobs, path, out_filepath) == 0) {
+    if (num_children == max_proc) {
+      result |= reap_child(children, &num_children);
+    }
+
+    // Anything still buffered would otherwise be written again by the child.
     fflush(stdout);
+    fflush(stderr);
 
-    switch (get_next(fd)) {
-      case CMD_CREATE:
-        if (parse_create(fd, &event_id, &num_rows, &num_columns) != 0) {
-          fprintf(stderr, "Invalid command. See HELP for usage\n");
-          continue;
-        }
+    pid_t pid = fork();
 
-        if (ems_create(event_id, num_rows, num_columns)) {
-          fprintf(stderr, "Failed to create event\n");
-        }
+    if (pid < 0) {
+      perror("Failed to fork worker process");
+      result = 1;
+      break;
+    }
 
-        break;
+    if (pid == 0) {
+      job_child(path, out_filepath);
+    }
 
-      case CMD_RESERVE:
-        num_coords = parse_reserve(fd, MAX_RESERVATION_SIZE, &event_id, xs, ys);
+    children[num_children].pid = pid;
+    strcpy(children[num_children].path, path);
+    num_children++;
+  }
+
+  while (num_children > 0) {
+    result |= reap_child(children, &num_children);
+  }
+
+  pthread_mutex_destroy(&jobs->lock);
+  free(children);
+  return result;
+}
 
-        if (num_coords == 0) {
-          fprintf(stderr, "Invalid command. See HELP for usage\n");
-          continue;
+int main(int argc, char *argv[]) {
+
+  unsigned int state_access_delay_ms = STATE_ACCESS_DELAY_MS;
+  unsigned int max_proc = DEFAULT_MAX_PROC;
+  unsigned int max_sessions = DEFAULT_MAX_SESSIONS;
+  unsigned int show_cache_bytes;
+  unsigned int log_window_us = WAL_GROUP_WINDOW_US;
+  const char *log_path = NULL;
+  const char *load_snapshot_path = NULL;
+  const char *save_snapshot_path = NULL;
+  const char *stats_path = NULL;
+  const char *trace_path = NULL;
+  const char *register_path = NULL;
+  int compile = 0;
+  int watch = 0;
+  int fork_workers = 0;
+  struct JobsDir jobs;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "p:t:m:e:k:L:g:z:Z:s:T:cr:n:wf")) != -1) {
+    switch (opt) {
+      case 'p':
+        if (parse_uint_arg(optarg, &max_proc) != 0 || max_proc == 0) {
+          fprintf(stderr, "Invalid max_proc value\n");
+          return 1;
         }
+        break;
 
-        if (ems_reserve(event_id, num_coords, xs, ys)) {
-          fprintf(stderr, "Failed to reserve seats\n");
+      case 't':
+        if (parse_uint_arg(optarg, &max_threads) != 0 || max_threads == 0) {
+          fprintf(stderr, "Invalid max_threads value\n");
+          return 1;
         }
+        break;
 
+      case 'm':
+        if (strcmp(optarg, "threads") == 0) {
+          exec_mode = EXEC_THREADS;
+        } else if (strcmp(optarg, "sharded") == 0) {
+          exec_mode = EXEC_SHARDED;
+        } else if (strcmp(optarg, "pipeline") == 0) {
+          exec_mode = EXEC_PIPELINE;
+        } else {
+          fprintf(stderr, "Invalid execution mode\n");
+          return 1;
+        }
         break;
 
-      case CMD_SHOW:
-        if (parse_show(fd, &event_id) != 0) {
-          fprintf(stderr, "Invalid command. See HELP for usage\n");
-          continue;
+      case 'e':
+        if (strcmp(optarg, "locked") == 0) {
+          ems_set_reserve_engine(RESERVE_LOCKED);
+        } else if (strcmp(optarg, "lockfree") == 0) {
+          ems_set_reserve_engine(RESERVE_LOCK_FREE);
+        } else {
+          fprintf(stderr, "Invalid reservation engine\n");
+          return 1;
         }
+        break;
 
-        if (ems_show(event_id, fdOut)) {
-          fprintf(stderr, "Failed to show event\n");
+      case 'k':
+        if (parse_uint_arg(optarg, &show_cache_bytes) != 0) {
+          fprintf(stderr, "Invalid show cache size\n");
+          return 1;
         }
+        ems_set_show_cache_size(show_cache_bytes);
+        break;
 
+      case 'L':
+        log_path = optarg;
         break;
 
-      case CMD_LIST_EVENTS:
-        if (ems_list_events(fdOut)) {
-          fprintf(stderr, "Failed to list events\n");
+      case 'g':
+        if (parse_uint_arg(optarg, &log_window_us) != 0) {
+          fprintf(stderr, "Invalid group commit window\n");
+          return 1;
         }
+        break;
 
+      case 'z':
+        load_snapshot_path = optarg;
         break;
 
-      case CMD_WAIT:
-        if (parse_wait(fd, &delay, NULL) == -1) {  // thread_id is not implemented
-          fprintf(stderr, "Invalid command. See HELP for usage\n");
-          continue;
-        }
+      case 'Z':
+        save_snapshot_path = optarg;
+        break;
 
-        if (delay > 0) {
-          printf("Waiting...\n");
-          ems_wait(delay);
+      case 's':
+        stats_path = optarg;
+        break;
+
+      case 'T':
+        trace_path = optarg;
+        break;
+
+      case 'c':
+        compile = 1;
+        break;
+
+      case 'r':
+        register_path = optarg;
+        break;
+
+      case 'n':
+        if (parse_uint_arg(optarg, &max_sessions) != 0 || max_sessions == 0) {
+          fprintf(stderr, "Invalid max_sessions value\n");
+          return 1;
         }
+        break;
 
+      case 'w':
+        watch = 1;
         break;
 
-      case CMD_INVALID:
-        fprintf(stderr, "Invalid command. See HELP for usage\n");
+      case 'f':
+        fork_workers = 1;
         break;
 
-      case CMD_HELP:
-        printf(//FAZER WRITE PARA DENTRO DO FICHEIRO
-            "Available commands:\n"
-            "  CREATE <event_id> <num_rows> <num_columns>\n"
-            "  RESERVE <event_id> [(<x1>,<y1>) (<x2>,<y2>) ...]\n"
-            "  SHOW <event_id>\n"
-            "  LIST\n"
-            "  WAIT <delay_ms> [thread_id]\n"  // thread_id is not implemented
-            "  BARRIER\n"                      // Not implemented
-            "  HELP\n");
+      default:
+        usage(argv[0]);
+        return 1;
+    }
+  }
+
+  if (compile) {
+    if (argc - optind != 2) {
+      usage(argv[0]);
+      return 1;
+    }
+
+    return compile_file(argv[optind], argv[optind + 1]);
+  }
+
+  // Only the event state is shared with the worker processes; the log, snapshot loading, stats,
+  // trace and show cache all keep state of their own in each process.
+  if (fork_workers && (log_path != NULL || load_snapshot_path != NULL || stats_path != NULL || trace_path != NULL ||
+                       register_path != NULL || watch)) {
+    fprintf(stderr, "Worker processes cannot be combined with -L, -z, -s, -T, -r or -w\n");
+    return 1;
+  }
+
+  if (fork_workers) {
+    ems_set_show_cache_size(0);
+  }
+
+  if (log_path != NULL) {
+    ems_set_log(log_path, log_window_us);
+  }
 
+  if (load_snapshot_path != NULL) {
+    ems_set_snapshot(load_snapshot_path);
+  }
+
+  if (register_path != NULL) {
+    if (argc - optind > 1 || watch) {
+      usage(argv[0]);
+      return 1;
+    }
+
+    if (argc - optind == 1 && parse_uint_arg(argv[optind], &state_access_delay_ms) != 0) {
+      fprintf(stderr, "Invalid delay value or value too large\n");
+      return 1;
+    }
+
+    if (ems_init(state_access_delay_ms)) {
+      fprintf(stderr, "Failed to initialize EMS\n");
+      return 1;
+    }
+
+    if (stats_path != NULL && stats_init(stats_path) != 0) {
+      fprintf(stderr, "Failed to initialize stats\n");
+      ems_terminate();
+      return 1;
+    }
+
+    if (trace_path != NULL && trace_init(trace_path) != 0) {
+      fprintf(stderr, "Failed to initialize trace\n");
+      stats_terminate();
+      ems_terminate();
+      return 1;
+    }
+
+    int result = ems_serve(register_path, max_sessions);
+
+    if (save_snapshot_path != NULL && ems_write_snapshot(save_snapshot_path) != 0) {
+      fprintf(stderr, "Failed to write snapshot\n");
+      result = 1;
+    }
+
+    trace_terminate();
+    stats_terminate();
+    ems_terminate();
+    return result;
+  }
+
+  if (argc - optind < 1) {
+
+    fprintf(stderr, "Not enough arguments\n");
+    usage(argv[0]);
+    return 1;
+    
+  }
+
+  else if (argc - optind > 1) {
+
+    if (parse_uint_arg(argv[optind + 1], &state_access_delay_ms) != 0) {
+      fprintf(stderr, "Invalid delay value or value too large\n");
+      return 1;
+    }
+  }
+
+  jobs.path = argv[optind];
+  jobs.dir = opendir(jobs.path);
+
+
+  if (jobs.dir == NULL){
+
+    perror("No such folder");
+    exit(1);
+  }
+
+  if (fork_workers && shmem_init(SHARED_STATE_BYTES) != 0) {
+    closedir(jobs.dir);
+    return 1;
+  }
+
+  // The shards of a single process own their events outright. Worker processes all run shards of
+  // their own over one shared table, so there every shard keeps locking.
+  if (!fork_workers && exec_mode == EXEC_SHARDED) {
+    ems_set_shards(max_threads);
+  }
+
+  if (ems_init(state_access_delay_ms)) {
+    fprintf(stderr, "Failed to initialize EMS\n");
+    shmem_terminate();
+    closedir(jobs.dir);
+    return 1;
+  }
+
+  if (stats_path != NULL && stats_init(stats_path) != 0) {
+    fprintf(stderr, "Failed to initialize stats\n");
+    ems_terminate();
+    closedir(jobs.dir);
+    return 1;
+  }
+
+  if (trace_path != NULL && trace_init(trace_path) != 0) {
+    fprintf(stderr, "Failed to initialize trace\n");
+    stats_terminate();
+    ems_terminate();
+    closedir(jobs.dir);
+    return 1;
+  }
+
+  // In sharded mode max_threads is the number of shards, shared by every job file.
+  if (!fork_workers && exec_mode == EXEC_SHARDED && shards_init(max_threads) != 0) {
+    fprintf(stderr, "Failed to start shards\n");
+    trace_terminate();
+    stats_terminate();
+    ems_terminate();
+    closedir(jobs.dir);
+    return 1;
+  }
+
+  int result;
+
+  if (fork_workers) {
+    result = run_jobs_forked(&jobs, max_proc);
+  } else if (watch) {
+    // The event state stays warm across every file that arrives until the watch is stopped.
+    result = ems_watch(jobs.path, max_proc, run_job_file);
+  } else {
+    result = run_jobs_dir(&jobs, max_proc);
+  }
+
+  if (!fork_workers && exec_mode == EXEC_SHARDED) {
+    shards_terminate();
+  }
+
+  if (save_snapshot_path != NULL && ems_write_snapshot(save_snapshot_path) != 0) {
+    fprintf(stderr, "Failed to write snapshot\n");
+    result = 1;
+  }
+
+  trace_terminate();
+  stats_terminate();
+  ems_terminate();
+  shmem_terminate();
+  closedir(jobs.dir);
+  return result;
+}
+
+
+  
+/// Reads and executes the commands of a job file.
+/// @note With several threads, every thread reads every command and executes the ones at the
+/// positions assigned to it, so that WAIT and BARRIER are seen by all of them.
+/// @param fd File descriptor of the job file, private to this thread.
+/// @param fdOut File descriptor of the output file.
+/// @param thread_id Id of this thread, from 1 to num_threads.
+/// @param num_threads Number of threads executing the file.
+/// @param barrier Barrier shared by the threads, NULL if there is a single thread.
+/// @return 0 once the end of the file was reached.
+int readFile(int fd, int fdOut, unsigned int thread_id, unsigned int num_threads, pthread_barrier_t *barrier){
+
+  unsigned int command_index = 0;
+  struct JobCommand command;
+
+  while (1) {
+    fflush(stdout);
+
+    enum Command cmd = get_next(fd);
+
+    // Commands that touch the state are dealt round-robin; WAIT and BARRIER concern every thread.
+    if (cmd != CMD_WAIT && cmd != CMD_BARRIER && cmd != CMD_EMPTY && cmd != EOC &&
+        command_index++ % num_threads != thread_id - 1) {
+      skip_command(fd, cmd);
+      continue;
+    }
+
+    command.cmd = cmd;
+    if (parse_command(fd, &command) != 0) {
+      // Every thread reads a WAIT, so only the first one reports it.
+      if (cmd != CMD_WAIT || thread_id == 1) {
+        fprintf(stderr, "Invalid command. See HELP for usage\n");
+      }
+      continue;
+    }
+
+    uint64_t span = trace_begin();
+
+    switch (cmd) {
+      case CMD_WAIT:
+        if (command.delay > 0 && command.wait_thread == 0) {  // Every thread waits
+          if (thread_id == 1) {
+            printf("Waiting...\n");
+          }
+          ems_wait(command.delay);
+        } else if (command.delay > 0 && command.wait_thread == thread_id) {  // Only the given thread waits
+          printf("Waiting...\n");
+          ems_wait(command.delay);
+        }
         break;
 
-      case CMD_BARRIER:  // Not implemented
-      case CMD_EMPTY:
+      case CMD_BARRIER:
+        if (barrier != NULL) {
+          pthread_barrier_wait(barrier);
+        }
         break;
 
       case EOC:
-    
         return 0;
+
+      case CMD_CREATE:
+      case CMD_RESERVE:
+      case CMD_RESERVE_BEST:
+      case CMD_RESERVE_RANGE:
+      case CMD_RESERVE_BLOCK:
+      case CMD_SHOW:
+      case CMD_SEATS:
+      case CMD_LIST_EVENTS:
+      case CMD_HELP:
+      case CMD_EMPTY:
+      case CMD_INVALID:  // Turned into CMD_EMPTY by parse_command
+        // Traced by execute_command itself.
+        execute_command(&command, fdOut);
+        continue;
     }
+
+    trace_end(command_name(cmd), TRACE_COMMAND, span);
   }
 }
-
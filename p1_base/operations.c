@@ -1,13 +1,48 @@
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <time.h>
 #include <unistd.h>
 #include <string.h>
 
+#include "constants.h"
 #include "eventlist.h"
+#include "operations.h"
+#include "showcache.h"
+#include "snapshot.h"
+#include "stats.h"
+#include "trace.h"
+#include "wal.h"
+#include "writer.h"
 
-static struct EventList* event_list = NULL;
+/// Event lists, event e belonging to lists[e % num_lists]. There is a single one unless events
+/// are split between shards.
+static struct EventList** lists = NULL;
+static unsigned int num_lists = 1;
+static int shards_own_events = 0;  // Set when each list is only ever changed by the shard owning it
 static unsigned int state_access_delay_ms = 0;
+static enum ReserveEngine reserve_engine = RESERVE_LOCKED;
+static const char* log_path = NULL;
+static const char* snapshot_path = NULL;
+static unsigned int log_window_us = WAL_GROUP_WINDOW_US;
+
+/// Keeps the output of a SHOW or LIST in one piece when several threads write to the same file, in
+/// case the kernel takes it in more than one write.
+static pthread_mutex_t output_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/// Writes out a rendered SHOW or LIST.
+/// @return 0 if the output was written, 1 otherwise.
+static int flush_output(struct Writer* writer, int fdOut) {
+  pthread_mutex_lock(&output_lock);
+  int result = writer_flush(writer, fdOut);
+  pthread_mutex_unlock(&output_lock);
+
+  if (result != 0) {
+    fprintf(stderr, "Error writing output\n");
+  }
+
+  return result;
+}
 
 /// Calculates a timespec from a delay in milliseconds.
 /// @param delay_ms Delay in milliseconds.
@@ -16,27 +51,66 @@ static struct timespec delay_to_timespec(unsigned int delay_ms) {
   return (struct timespec){delay_ms / 1000, (delay_ms % 1000) * 1000000};
 }
 
+/// Gets the list an event belongs to.
+static struct EventList* list_of(unsigned int event_id) { return lists[event_id % num_lists]; }
+
+/// Waits to simulate a real system accessing a costly memory resource.
+/// @note Never called with a lock of the event list held, so that the wait does not block other
+/// threads.
+static void state_access_delay() {
+  uint64_t span = trace_begin();
+  struct timespec delay = delay_to_timespec(state_access_delay_ms);
+  nanosleep(&delay, NULL);  // Should not be removed
+  trace_end("access delay", TRACE_WAIT, span);
+}
+
 /// Gets the event with the given ID from the state.
 /// @note Will wait to simulate a real system accessing a costly memory resource.
 /// @param event_id The ID of the event to get.
 /// @return Pointer to the event if found, NULL otherwise.
 static struct Event* get_event_with_delay(unsigned int event_id) {
-  struct timespec delay = delay_to_timespec(state_access_delay_ms);
-  nanosleep(&delay, NULL);  // Should not be removed
+  stats_count(STATS_EVENT_ACCESSES);
+  state_access_delay();
 
-  return get_event(event_list, event_id);
+  return get_event(list_of(event_id), event_id);
 }
 
-/// Gets the seat with the given index from the state.
+/// Gets the reservation of the seat with the given index from the state.
 /// @note Will wait to simulate a real system accessing a costly memory resource.
 /// @param event Event to get the seat from.
 /// @param index Index of the seat to get.
-/// @return Pointer to the seat.
-static unsigned int* get_seat_with_delay(struct Event* event, size_t index) {
-  struct timespec delay = delay_to_timespec(state_access_delay_ms);
-  nanosleep(&delay, NULL);  // Should not be removed
+/// @return Reservation id of the seat, 0 if it is free.
+static unsigned int get_seat_with_delay(struct Event* event, size_t index) {
+  stats_count(STATS_SEAT_ACCESSES);
+  state_access_delay();
 
-  return &event->data[index];
+  return seat_get(event, index);
+}
+
+/// Sets the reservation of the seat with the given index in the state.
+/// @note Will wait to simulate a real system accessing a costly memory resource.
+/// @param event Event to set the seat in.
+/// @param index Index of the seat to set.
+/// @param value Reservation id, 0 to free the seat.
+/// @return 0 if the seat was set, 1 otherwise.
+static int set_seat_with_delay(struct Event* event, size_t index, unsigned int value) {
+  stats_count(STATS_SEAT_ACCESSES);
+  state_access_delay();
+
+  return seat_set(event, index, value);
+}
+
+/// Claims the seat with the given index in the state if it is free.
+/// @note Will wait to simulate a real system accessing a costly memory resource.
+/// @param event Event to claim the seat in.
+/// @param index Index of the seat to claim.
+/// @param value Reservation id.
+/// @return 0 if the seat was claimed, 1 if it was taken, -1 if it could not be stored.
+static int claim_seat_with_delay(struct Event* event, size_t index, unsigned int value) {
+  stats_count(STATS_SEAT_ACCESSES);
+  state_access_delay();
+
+  return seat_claim(event, index, value);
 }
 
 /// Gets the index of a seat.
@@ -47,75 +121,589 @@ static unsigned int* get_seat_with_delay(struct Event* event, size_t index) {
 /// @return Index of the seat.
 static size_t seat_index(struct Event* event, size_t row, size_t col) { return (row - 1) * event->cols + col - 1; }
 
+/// Orders seat or lock indices in ascending order.
+static int compare_indices(const void* a, const void* b) {
+  size_t x = *(const size_t*)a;
+  size_t y = *(const size_t*)b;
+  return (x > y) - (x < y);
+}
+
+/// Locks the seat locks covering the given seats.
+/// @note Locks are always taken in ascending order, so that two reservations can never wait on
+/// each other.
+/// @param event Event the seats belong to.
+/// @param seats Indices of the seats.
+/// @param num_seats Number of seats.
+/// @param locks Buffer of num_seats entries to store the indices of the locks taken in.
+/// @return Number of locks taken.
+static size_t lock_seats(struct Event* event, const size_t* seats, size_t num_seats, size_t* locks) {
+  for (size_t i = 0; i < num_seats; i++) {
+    locks[i] = seats[i] % event->num_seat_locks;
+  }
+  qsort(locks, num_seats, sizeof(size_t), compare_indices);
+
+  size_t num_locks = 0;
+  for (size_t i = 0; i < num_seats; i++) {
+    if (num_locks == 0 || locks[num_locks - 1] != locks[i]) {
+      locks[num_locks++] = locks[i];
+      pthread_mutex_lock(&event->seat_locks[locks[i]]);
+    }
+  }
+
+  return num_locks;
+}
+
+/// Unlocks the seat locks taken by lock_seats.
+static void unlock_seats(struct Event* event, const size_t* locks, size_t num_locks) {
+  for (size_t i = num_locks; i > 0; i--) {
+    pthread_mutex_unlock(&event->seat_locks[locks[i - 1]]);
+  }
+}
+
+/// Reads one seat while holding its seat lock, so that no reservation writes it meanwhile.
+static unsigned int get_seat_locked(struct Event* event, size_t index) {
+  pthread_mutex_t* lock = &event->seat_locks[index % event->num_seat_locks];
+  pthread_mutex_lock(lock);
+  unsigned int seat = get_seat_with_delay(event, index);
+  pthread_mutex_unlock(lock);
+  return seat;
+}
+
+/// Claims the given seats while holding their seat locks.
+/// @param event Event to reserve seats in.
+/// @param seats Indices of the seats, sorted and without repetitions.
+/// @param num_seats Number of seats.
+/// @param locks Buffer of num_seats entries for the indices of the seat locks.
+/// @param reservation_id Set to the id of the reservation if every seat was claimed.
+/// @return 0 if every seat was claimed, 1 otherwise.
+static int reserve_locked(struct Event* event, const size_t* seats, size_t num_seats, size_t* locks,
+                          unsigned int* reservation_id) {
+  // Reservations share the event lock and exclude each other seat by seat; block reservations take
+  // it exclusively.
+  uint64_t span = trace_begin();
+  pthread_rwlock_rdlock(&event->lock);
+  size_t num_locks = lock_seats(event, seats, num_seats, locks);
+  trace_end("seat locks", TRACE_WAIT, span);
+
+  size_t i = 0;
+  for (; i < num_seats; i++) {
+    if (get_seat_with_delay(event, seats[i]) != 0) {
+      fprintf(stderr, "Seat already reserved\n");
+      stats_count(STATS_RESERVE_CONFLICTS);
+      break;
+    }
+  }
+
+  if (i == num_seats) {
+    *reservation_id = __atomic_add_fetch(&event->reservations, 1, __ATOMIC_RELAXED);
+
+    if (begin_seat_writes(event, *reservation_id) == 0) {
+      size_t j = 0;
+      for (; j < num_seats; j++) {
+        if (set_seat_with_delay(event, seats[j], *reservation_id)) break;
+      }
+
+      if (j == num_seats) {
+        mark_seats_reserved(event, seats, num_seats);
+      } else {
+        // Undo the partial reservation; seats already written never need memory to be freed.
+        fprintf(stderr, "Error allocating memory for seats\n");
+        while (j > 0) set_seat_with_delay(event, seats[--j], 0);
+        i = 0;
+      }
+
+      end_seat_writes(event);
+    } else {
+      fprintf(stderr, "Error allocating memory for seats\n");
+      i = 0;
+    }
+  }
+
+  unlock_seats(event, locks, num_locks);
+  pthread_rwlock_unlock(&event->lock);
+
+  return i < num_seats;
+}
+
+/// Gives back the id drawn by a lock-free reservation that failed, unless a later reservation
+/// already drew the next one.
+static void give_back_reservation_id(struct Event* event, unsigned int reservation_id) {
+  unsigned int expected = reservation_id;
+  __atomic_compare_exchange_n(&event->reservations, &expected, reservation_id - 1, 0, __ATOMIC_RELAXED,
+                              __ATOMIC_RELAXED);
+}
+
+/// Claims the given seats without taking any lock, swapping each one from free to the reservation
+/// id and releasing the ones already claimed once a seat turns out to be taken.
+/// @note Seats are claimed in ascending order, so of two conflicting reservations the one that gets
+/// their lowest common seat first cannot be undone by the other.
+/// @param event Event to reserve seats in.
+/// @param seats Indices of the seats, sorted and without repetitions.
+/// @param num_seats Number of seats.
+/// @param id Set to the id of the reservation if every seat was claimed.
+/// @return 0 if every seat was claimed, 1 otherwise.
+static int reserve_lock_free(struct Event* event, const size_t* seats, size_t num_seats, unsigned int* id) {
+  unsigned int reservation_id = __atomic_add_fetch(&event->reservations, 1, __ATOMIC_RELAXED);
+
+  if (begin_seat_writes(event, reservation_id) != 0) {
+    fprintf(stderr, "Error allocating memory for seats\n");
+    give_back_reservation_id(event, reservation_id);
+    return 1;
+  }
+
+  size_t i = 0;
+  for (; i < num_seats; i++) {
+    int result = claim_seat_with_delay(event, seats[i], reservation_id);
+
+    if (result < 0) {
+      fprintf(stderr, "Error allocating memory for seats\n");
+      break;
+    } else if (result > 0) {
+      fprintf(stderr, "Seat already reserved\n");
+      stats_count(STATS_RESERVE_CONFLICTS);
+      break;
+    }
+  }
+
+  if (i == num_seats) {
+    mark_seats_reserved(event, seats, num_seats);
+    end_seat_writes(event);
+    *id = reservation_id;
+    return 0;
+  }
+
+  for (size_t j = 0; j < i; j++) {
+    set_seat_with_delay(event, seats[j], 0);
+  }
+
+  // A SHOW may have seen the seats claimed so far, so its output must not outlive the rollback.
+  if (i > 0) {
+    __atomic_add_fetch(&event->version, 1, __ATOMIC_RELEASE);
+  }
+  end_seat_writes(event);
+  give_back_reservation_id(event, reservation_id);
+
+  return 1;
+}
+
+/// Claims the given seats of an event owned by the calling shard. No other thread reads or writes
+/// the seats meanwhile, so no lock is taken and every seat is checked before any is written.
+/// @param event Event to reserve seats in.
+/// @param seats Indices of the seats, sorted and without repetitions.
+/// @param num_seats Number of seats.
+/// @param reservation_id Set to the id of the reservation if every seat was claimed.
+/// @return 0 if every seat was claimed, 1 otherwise.
+static int reserve_owned(struct Event* event, const size_t* seats, size_t num_seats, unsigned int* reservation_id) {
+  for (size_t i = 0; i < num_seats; i++) {
+    if (get_seat_with_delay(event, seats[i]) != 0) {
+      fprintf(stderr, "Seat already reserved\n");
+      stats_count(STATS_RESERVE_CONFLICTS);
+      return 1;
+    }
+  }
+
+  if (begin_seat_writes(event, event->reservations + 1) != 0) {
+    fprintf(stderr, "Error allocating memory for seats\n");
+    return 1;
+  }
+
+  size_t j = 0;
+  for (; j < num_seats; j++) {
+    if (set_seat_with_delay(event, seats[j], event->reservations + 1)) break;
+  }
+
+  if (j < num_seats) {
+    // Undo the partial reservation; seats already written never need memory to be freed.
+    fprintf(stderr, "Error allocating memory for seats\n");
+    while (j > 0) set_seat_with_delay(event, seats[--j], 0);
+    end_seat_writes(event);
+    return 1;
+  }
+
+  *reservation_id = ++event->reservations;
+  mark_seats_reserved(event, seats, num_seats);
+  end_seat_writes(event);
+
+  return 0;
+}
+
+/// Claims the given seats with the selected engine, without logging the reservation.
+/// @param event Event to reserve seats in.
+/// @param seats Indices of the seats, sorted and without repetitions.
+/// @param num_seats Number of seats.
+/// @param locks Buffer of num_seats entries for the indices of the seat locks.
+/// @param reservation_id Set to the id of the reservation if every seat was claimed.
+/// @return 0 if every seat was claimed, 1 otherwise.
+static int claim_with_engine(struct Event* event, const size_t* seats, size_t num_seats, size_t* locks,
+                             unsigned int* reservation_id) {
+  if (shards_own_events) {
+    return reserve_owned(event, seats, num_seats, reservation_id);
+  }
+
+  return reserve_engine == RESERVE_LOCK_FREE ? reserve_lock_free(event, seats, num_seats, reservation_id)
+                                             : reserve_locked(event, seats, num_seats, locks, reservation_id);
+}
+
+/// Takes back a reservation whose log record could not be made durable, so that the state never
+/// holds a reservation the log may have lost. The seats are freed the way the engine in use would
+/// write them.
+/// @param event Event the seats were reserved in.
+/// @param seats Indices of the seats, sorted and without repetitions.
+/// @param num_seats Number of seats.
+/// @param locks Buffer of num_seats entries for the indices of the seat locks.
+static void rollback_seats(struct Event* event, const size_t* seats, size_t num_seats, size_t* locks) {
+  int locked = !shards_own_events && reserve_engine == RESERVE_LOCKED;
+  size_t num_locks = 0;
+
+  mark_seats_free(event, seats, num_seats);
+
+  if (locked) {
+    pthread_rwlock_rdlock(&event->lock);
+    num_locks = lock_seats(event, seats, num_seats, locks);
+  }
+
+  // Freeing a seat never needs wider seats or more memory.
+  begin_seat_writes(event, 0);
+  for (size_t i = 0; i < num_seats; i++) {
+    seat_set(event, seats[i], 0);
+  }
+  __atomic_add_fetch(&event->version, 1, __ATOMIC_RELEASE);
+  end_seat_writes(event);
+
+  if (locked) {
+    unlock_seats(event, locks, num_locks);
+    pthread_rwlock_unlock(&event->lock);
+  }
+}
+
+/// Claims the given seats with the selected engine.
+/// @note The seats are visible as soon as they are claimed. If the reservation cannot be logged,
+/// it is rolled back.
+/// @param event Event to reserve seats in.
+/// @param seats Indices of the seats, sorted and without repetitions.
+/// @param num_seats Number of seats.
+/// @param locks Buffer of num_seats entries for the indices of the seat locks.
+/// @return 0 if every seat was claimed, 1 otherwise.
+static int claim_seats(struct Event* event, const size_t* seats, size_t num_seats, size_t* locks) {
+  unsigned int reservation_id;
+  int result = claim_with_engine(event, seats, num_seats, locks, &reservation_id);
+
+  if (result != 0) {
+    return result;
+  }
+
+  // Successful reservations never overlap, so their records may reach the log in any order.
+  if (wal_sync(wal_log_reserve(event->id, reservation_id, seats, num_seats)) != 0) {
+    fprintf(stderr, "Failed to log reservation\n");
+    rollback_seats(event, seats, num_seats, locks);
+    return 1;
+  }
+
+  stats_count(STATS_RESERVE_SUCCESSES);
+  return 0;
+}
+
+void ems_set_reserve_engine(enum ReserveEngine engine) { reserve_engine = engine; }
+
+void ems_set_shards(unsigned int num_shards) {
+  num_lists = num_shards;
+  shards_own_events = 1;
+}
+
+void ems_set_show_cache_size(size_t bytes) { show_cache_set_budget(bytes); }
+
+void ems_set_snapshot(const char* path) { snapshot_path = path; }
+
+void ems_set_log(const char* path, unsigned int window_us) {
+  log_path = path;
+  log_window_us = window_us;
+}
+
+/// Recreates a logged event.
+static int replay_create(unsigned int event_id, size_t num_rows, size_t num_cols) {
+  struct EventList* list = list_of(event_id);
+
+  if (get_event(list, event_id) != NULL) {
+    fprintf(stderr, "Event already exists\n");
+    return 1;
+  }
+
+  struct Event* event = create_event(list, event_id, num_rows, num_cols);
+
+  if (event == NULL || append_to_list(list, event) != 0) {
+    fprintf(stderr, "Error allocating memory for event\n");
+    return 1;
+  }
+
+  return 0;
+}
+
+/// Restores a logged reservation with the id it was given.
+static int replay_reserve(unsigned int event_id, unsigned int reservation_id, const size_t* seats, size_t num_seats) {
+  struct Event* event = get_event(list_of(event_id), event_id);
+
+  if (event == NULL) {
+    fprintf(stderr, "Event not found\n");
+    return 1;
+  }
+
+  for (size_t i = 0; i < num_seats; i++) {
+    if (seats[i] >= event->rows * event->cols || seat_get(event, seats[i]) != 0) {
+      fprintf(stderr, "Invalid seat\n");
+      return 1;
+    }
+  }
+
+  if (begin_seat_writes(event, reservation_id) != 0) {
+    fprintf(stderr, "Error allocating memory for seats\n");
+    return 1;
+  }
+
+  for (size_t i = 0; i < num_seats; i++) {
+    if (seat_set(event, seats[i], reservation_id) != 0) {
+      fprintf(stderr, "Error allocating memory for seats\n");
+      end_seat_writes(event);
+      return 1;
+    }
+  }
+
+  mark_seats_reserved(event, seats, num_seats);
+  end_seat_writes(event);
+
+  if (reservation_id > event->reservations) {
+    event->reservations = reservation_id;
+  }
+
+  return 0;
+}
+
+/// Restores a logged reservation of a rectangle of seats with the id it was given.
+static int replay_reserve_block(unsigned int event_id, unsigned int reservation_id, size_t first_row,
+                                size_t first_col, size_t num_rows, size_t num_cols) {
+  struct Event* event = get_event(list_of(event_id), event_id);
+
+  if (event == NULL) {
+    fprintf(stderr, "Event not found\n");
+    return 1;
+  }
+
+  if (num_rows == 0 || num_cols == 0 || first_row >= event->rows || num_rows > event->rows - first_row ||
+      first_col >= event->cols || num_cols > event->cols - first_col) {
+    fprintf(stderr, "Invalid seat\n");
+    return 1;
+  }
+
+  for (size_t row = first_row; row < first_row + num_rows; row++) {
+    for (size_t col = first_col; col < first_col + num_cols; col++) {
+      if (seat_get(event, row * event->cols + col) != 0) {
+        fprintf(stderr, "Invalid seat\n");
+        return 1;
+      }
+    }
+  }
+
+  if (begin_seat_writes(event, reservation_id) != 0) {
+    fprintf(stderr, "Error allocating memory for seats\n");
+    return 1;
+  }
+
+  for (size_t row = first_row; row < first_row + num_rows; row++) {
+    for (size_t col = first_col; col < first_col + num_cols; col++) {
+      if (seat_set(event, row * event->cols + col, reservation_id) != 0) {
+        fprintf(stderr, "Error allocating memory for seats\n");
+        end_seat_writes(event);
+        return 1;
+      }
+    }
+  }
+
+  mark_block_reserved(event, first_row, first_col, num_rows, num_cols);
+  end_seat_writes(event);
+
+  if (reservation_id > event->reservations) {
+    event->reservations = reservation_id;
+  }
+
+  return 0;
+}
+
+/// Frees every event list. Lists after the first only borrow its snapshot.
+static void free_lists() {
+  for (unsigned int i = 0; i < num_lists; i++) {
+    if (lists[i] != NULL) {
+      if (i > 0) {
+        lists[i]->snapshot = NULL;
+      }
+      free_list(lists[i]);
+    }
+  }
+
+  free(lists);
+  lists = NULL;
+}
+
 int ems_init(unsigned int delay_ms) {
-  if (event_list != NULL) {
+  if (lists != NULL) {
     fprintf(stderr, "EMS state has already been initialized\n");
     return 1;
   }
 
-  event_list = create_list();
+  lists = calloc(num_lists, sizeof(struct EventList*));
   state_access_delay_ms = delay_ms;
 
-  return event_list == NULL;
+  if (lists == NULL) {
+    fprintf(stderr, "Error allocating memory for event lists\n");
+    return 1;
+  }
+
+  for (unsigned int i = 0; i < num_lists; i++) {
+    lists[i] = create_list();
+
+    if (lists[i] == NULL) {
+      free_lists();
+      return 1;
+    }
+  }
+
+  if (snapshot_path != NULL && snapshot_map(lists[0], snapshot_path) != 0) {
+    fprintf(stderr, "Failed to load snapshot\n");
+    free_lists();
+    return 1;
+  }
+
+  // Each event of the snapshot is only ever looked up, and so set up, in the list it belongs to.
+  for (unsigned int i = 1; i < num_lists; i++) {
+    lists[i]->snapshot = lists[0]->snapshot;
+  }
+
+  // Replay applies records directly, without the simulated access delays.
+  const struct WalHandlers handlers = {
+      .create = replay_create, .reserve = replay_reserve, .reserve_block = replay_reserve_block};
+
+  // The snapshot already reflects the log up to the length it records, so only the rest is replayed.
+  if (log_path != NULL && wal_open(log_path, log_window_us, snapshot_log_length(lists[0]->snapshot), &handlers) != 0) {
+    fprintf(stderr, "Failed to replay log\n");
+    free_lists();
+    return 1;
+  }
+
+  return 0;
+}
+
+int ems_write_snapshot(const char* path) {
+  if (lists == NULL) {
+    fprintf(stderr, "EMS state must be initialized\n");
+    return 1;
+  }
+
+  // Without a log, the state still reflects as much of one as the snapshot it was loaded from.
+  uint64_t log_length = snapshot_log_length(lists[0]->snapshot);
+
+  if (log_path != NULL && wal_length(&log_length) != 0) {
+    fprintf(stderr, "Failed to log the state to snapshot\n");
+    return 1;
+  }
+
+  for (unsigned int i = 0; i < num_lists; i++) {
+    pthread_rwlock_wrlock(&lists[i]->lock);
+  }
+
+  int result = snapshot_write(lists, num_lists, log_length, path);
+
+  for (unsigned int i = num_lists; i > 0; i--) {
+    pthread_rwlock_unlock(&lists[i - 1]->lock);
+  }
+
+  return result;
 }
 
 int ems_terminate() {
-  if (event_list == NULL) {
+  if (lists == NULL) {
     fprintf(stderr, "EMS state must be initialized\n");
     return 1;
   }
 
-  free_list(event_list);
+  wal_close();
+  show_cache_clear();
+  free_lists();
   return 0;
 }
 
-int ems_create(unsigned int event_id, size_t num_rows, size_t num_cols) {
-  if (event_list == NULL) {
+/// Takes the lock serializing the changes to a list, unless the calling shard owns the list and so
+/// is the only thread changing it.
+static void lock_list(struct EventList* list) {
+  if (!shards_own_events) {
+    pthread_rwlock_wrlock(&list->lock);
+  }
+}
+
+/// Releases the lock taken by lock_list.
+static void unlock_list(struct EventList* list) {
+  if (!shards_own_events) {
+    pthread_rwlock_unlock(&list->lock);
+  }
+}
+
+static int create(unsigned int event_id, size_t num_rows, size_t num_cols) {
+  if (lists == NULL) {
     fprintf(stderr, "EMS state must be initialized\n");
     return 1;
   }
 
-  if (get_event_with_delay(event_id) != NULL) {
+  // The lookup below is made under the list lock, so it cannot go through get_event_with_delay,
+  // but it is still an access to the state.
+  stats_count(STATS_EVENT_ACCESSES);
+  state_access_delay();
+
+  // The lookup and the claim of the id must not be separated, or two threads could create the same
+  // event.
+  struct EventList* list = list_of(event_id);
+  lock_list(list);
+
+  if (get_event(list, event_id) != NULL || is_pending(list, event_id)) {
     fprintf(stderr, "Event already exists\n");
+    unlock_list(list);
     return 1;
   }
 
-  struct Event* event = malloc(sizeof(struct Event));
+  struct Event* event = create_event(list, event_id, num_rows, num_cols);
 
   if (event == NULL) {
     fprintf(stderr, "Error allocating memory for event\n");
+    unlock_list(list);
     return 1;
   }
 
-  event->id = event_id;
-  event->rows = num_rows;
-  event->cols = num_cols;
-  event->reservations = 0;
-  event->data = malloc(num_rows * num_cols * sizeof(unsigned int));
+  // The event only becomes visible once its record is durable, so that no reservation on it can be
+  // made, or logged, before it. Until then it is kept pending, which holds its id, so that the list
+  // is not locked while waiting for the log and concurrent creates can share an fsync.
+  uint64_t lsn = wal_log_create(event_id, num_rows, num_cols);
+  add_pending(list, event);
+  unlock_list(list);
 
-  if (event->data == NULL) {
-    fprintf(stderr, "Error allocating memory for event data\n");
-    free(event);
-    return 1;
-  }
+  int logged = wal_sync(lsn);
 
-  for (size_t i = 0; i < num_rows * num_cols; i++) {
-    event->data[i] = 0;
-  }
+  lock_list(list);
+  remove_pending(list, event);
 
+  if (logged != 0) {
+    fprintf(stderr, "Failed to log event\n");
+    unlock_list(list);
+    return 1;
+  }
 
-  if (append_to_list(event_list, event) != 0) {
+  if (append_to_list(list, event) != 0) {
     fprintf(stderr, "Error appending event to list\n");
-    free(event->data);
-    free(event);
+    unlock_list(list);
     return 1;
   }
 
+  unlock_list(list);
   return 0;
 }
 
-int ems_reserve(unsigned int event_id, size_t num_seats, size_t* xs, size_t* ys) {
-  if (event_list == NULL) {
+static int reserve(unsigned int event_id, size_t num_seats, size_t* xs, size_t* ys) {
+  if (lists == NULL) {
     fprintf(stderr, "EMS state must be initialized\n");
     return 1;
   }
@@ -127,48 +715,260 @@ int ems_reserve(unsigned int event_id, size_t num_seats, size_t* xs, size_t* ys)
     return 1;
   }
 
-  unsigned int reservation_id = ++event->reservations;
+  size_t* seats = malloc(2 * num_seats * sizeof(size_t));
 
-  size_t i = 0;
-  for (; i < num_seats; i++) {
+  if (seats == NULL) {
+    fprintf(stderr, "Error allocating memory for reservation\n");
+    return 1;
+  }
+
+  size_t* locks = seats + num_seats;
+
+  for (size_t i = 0; i < num_seats; i++) {
     size_t row = xs[i];
     size_t col = ys[i];
 
     if (row <= 0 || row > event->rows || col <= 0 || col > event->cols) {
       fprintf(stderr, "Invalid seat\n");
-      break;
+      free(seats);
+      return 1;
     }
 
-    if (*get_seat_with_delay(event, seat_index(event, row, col)) != 0) {
+    seats[i] = seat_index(event, row, col);
+  }
+
+  // A seat named twice would be reserved twice.
+  qsort(seats, num_seats, sizeof(size_t), compare_indices);
+  for (size_t i = 1; i < num_seats; i++) {
+    if (seats[i] == seats[i - 1]) {
       fprintf(stderr, "Seat already reserved\n");
+      free(seats);
+      return 1;
+    }
+  }
+
+  int result = claim_seats(event, seats, num_seats, locks);
+
+  free(seats);
+  return result;
+}
+
+static int render_reserve_best(unsigned int event_id, size_t num_seats, struct Writer* writer) {
+  if (lists == NULL) {
+    fprintf(stderr, "EMS state must be initialized\n");
+    return 1;
+  }
+
+  struct Event* event = get_event_with_delay(event_id);
+
+  if (event == NULL) {
+    fprintf(stderr, "Event not found\n");
+    return 1;
+  }
+
+  size_t* seats = malloc(2 * num_seats * sizeof(size_t));
+
+  if (seats == NULL) {
+    fprintf(stderr, "Error allocating memory for reservation\n");
+    return 1;
+  }
+
+  size_t* locks = seats + num_seats;
+
+  // The bitmap is only a hint: a concurrent reservation may take the seats found before they are
+  // claimed, in which case the search starts over.
+  for (unsigned int attempt = 0; attempt < RESERVE_BEST_ATTEMPTS; attempt++) {
+    size_t first;
+
+    if (find_free_seats(event, num_seats, &first) != 0) {
       break;
     }
 
-    *get_seat_with_delay(event, seat_index(event, row, col)) = reservation_id;
+    for (size_t i = 0; i < num_seats; i++) {
+      seats[i] = first + i;
+    }
+
+    if (claim_seats(event, seats, num_seats, locks) == 0) {
+      // The seats assigned are written the way RESERVE takes them.
+      for (size_t i = 0; i < num_seats; i++) {
+        writer_put(writer, i ? " (" : "(", i ? 2 : 1);
+        writer_put_uint(writer, (unsigned int)(seats[i] / event->cols + 1));
+        writer_put_char(writer, ',');
+        writer_put_uint(writer, (unsigned int)(seats[i] % event->cols + 1));
+        writer_put_char(writer, ')');
+      }
+      writer_put_char(writer, '\n');
+
+      free(seats);
+      return 0;
+    }
   }
 
-  // If the reservation was not successful, free the seats that were reserved.
-  if (i < num_seats) {
-    event->reservations--;
-    for (size_t j = 0; j < i; j++) {
-      *get_seat_with_delay(event, seat_index(event, xs[j], ys[j])) = 0;
+  fprintf(stderr, "No adjacent free seats\n");
+  free(seats);
+  return 1;
+}
+
+static int reserve_best(unsigned int event_id, size_t num_seats, int fdOut) {
+  struct Writer writer;
+  writer_init(&writer, 16 * num_seats);
+
+  int result = render_reserve_best(event_id, num_seats, &writer);
+
+  if (result == 0) {
+    result = flush_output(&writer, fdOut);
+  }
+
+  writer_destroy(&writer);
+  return result;
+}
+
+/// Claims a rectangle of seats of a dense event in one go, checking and writing each row of it as
+/// a whole instead of seat by seat.
+/// @note Reads and writes the seats without atomics, so nothing else may touch them meanwhile.
+/// @param event Event to reserve seats in, with data allocated.
+/// @param reservation_id Set to the id of the reservation if every seat was claimed.
+/// @return 0 if every seat was claimed, 1 otherwise.
+static int fill_block_dense(struct Event* event, size_t first_row, size_t first_col, size_t num_rows,
+                            size_t num_cols, unsigned int* reservation_id) {
+  for (size_t row = first_row; row < first_row + num_rows; row++) {
+    stats_count(STATS_SEAT_ACCESSES);
+    state_access_delay();
+
+    if (!span_is_free(event, row * event->cols + first_col, num_cols)) {
+      fprintf(stderr, "Seat already reserved\n");
+      stats_count(STATS_RESERVE_CONFLICTS);
+      return 1;
     }
+  }
+
+  *reservation_id = __atomic_add_fetch(&event->reservations, 1, __ATOMIC_RELAXED);
+
+  if (begin_seat_writes(event, *reservation_id) != 0) {
+    fprintf(stderr, "Error allocating memory for seats\n");
     return 1;
   }
 
+  for (size_t row = first_row; row < first_row + num_rows; row++) {
+    stats_count(STATS_SEAT_ACCESSES);
+    state_access_delay();
+
+    span_fill(event, row * event->cols + first_col, num_cols, *reservation_id);
+  }
+
+  mark_block_reserved(event, first_row, first_col, num_rows, num_cols);
+  end_seat_writes(event);
+
   return 0;
 }
 
-int ems_show(unsigned int event_id, int fdOut) {
+/// Claims a rectangle of seats of a dense event like fill_block_dense, holding the event lock
+/// exclusively to keep other reservations and SHOW out.
+/// @note Must only be used with the locked engine, whose reservations share that lock.
+static int reserve_block_dense(struct Event* event, size_t first_row, size_t first_col, size_t num_rows,
+                               size_t num_cols, unsigned int* reservation_id) {
+  uint64_t span = trace_begin();
+  pthread_rwlock_wrlock(&event->lock);
+  trace_end("event lock", TRACE_WAIT, span);
 
-  char buffer[128];
-  
+  int result = fill_block_dense(event, first_row, first_col, num_rows, num_cols, reservation_id);
 
-  if (event_list == NULL) {
+  pthread_rwlock_unlock(&event->lock);
+  return result;
+}
+
+/// Takes back a reservation of a rectangle of seats that could not be logged, like rollback_seats.
+/// @param first_row Row of the top left seat, starting at 0.
+/// @param first_col Column of the top left seat, starting at 0.
+static void rollback_block(struct Event* event, size_t first_row, size_t first_col, size_t num_rows,
+                           size_t num_cols) {
+  size_t num_seats = num_rows * num_cols;
+  size_t* seats = malloc(2 * num_seats * sizeof(size_t));
+
+  // Nothing is durable after a log failure, so the seats at least stay out of later reservations.
+  if (seats == NULL) {
+    fprintf(stderr, "Error allocating memory to roll the reservation back\n");
+    return;
+  }
+
+  for (size_t i = 0; i < num_seats; i++) {
+    seats[i] = (first_row + i / num_cols) * event->cols + first_col + i % num_cols;
+  }
+
+  rollback_seats(event, seats, num_seats, seats + num_seats);
+  free(seats);
+}
+
+static int reserve_block(unsigned int event_id, size_t first_row, size_t first_col, size_t last_row,
+                         size_t last_col) {
+  if (lists == NULL) {
     fprintf(stderr, "EMS state must be initialized\n");
     return 1;
   }
 
+  struct Event* event = get_event_with_delay(event_id);
+
+  if (event == NULL) {
+    fprintf(stderr, "Event not found\n");
+    return 1;
+  }
+
+  if (first_row <= 0 || first_row > last_row || last_row > event->rows || first_col <= 0 || first_col > last_col ||
+      last_col > event->cols) {
+    fprintf(stderr, "Invalid seat\n");
+    return 1;
+  }
+
+  size_t num_rows = last_row - first_row + 1;
+  size_t num_cols = last_col - first_col + 1;
+  unsigned int reservation_id;
+  int result;
+
+  int dense = __atomic_load_n(&event->data, __ATOMIC_ACQUIRE) != NULL;
+
+  if (dense && shards_own_events) {
+    result = fill_block_dense(event, first_row - 1, first_col - 1, num_rows, num_cols, &reservation_id);
+  } else if (dense && reserve_engine == RESERVE_LOCKED) {
+    result = reserve_block_dense(event, first_row - 1, first_col - 1, num_rows, num_cols, &reservation_id);
+  } else {
+    // Lock-free reservations and sparse seats have no contiguous array to work on, so the seats
+    // are claimed one by one like those of any other reservation.
+    size_t num_seats = num_rows * num_cols;
+    size_t* seats = malloc(2 * num_seats * sizeof(size_t));
+
+    if (seats == NULL) {
+      fprintf(stderr, "Error allocating memory for reservation\n");
+      return 1;
+    }
+
+    for (size_t i = 0; i < num_seats; i++) {
+      seats[i] = seat_index(event, first_row + i / num_cols, first_col + i % num_cols);
+    }
+
+    result = claim_with_engine(event, seats, num_seats, seats + num_seats, &reservation_id);
+    free(seats);
+  }
+
+  if (result != 0) {
+    return result;
+  }
+
+  if (wal_sync(wal_log_reserve_block(event->id, reservation_id, first_row - 1, first_col - 1, num_rows, num_cols)) !=
+      0) {
+    fprintf(stderr, "Failed to log reservation\n");
+    rollback_block(event, first_row - 1, first_col - 1, num_rows, num_cols);
+    return 1;
+  }
+
+  stats_count(STATS_RESERVE_SUCCESSES);
+  return 0;
+}
+
+static int render_free_seats(unsigned int event_id, struct Writer* writer) {
+  if (lists == NULL) {
+    fprintf(stderr, "EMS state must be initialized\n");
+    return 1;
+  }
 
   struct Event* event = get_event_with_delay(event_id);
 
@@ -176,53 +976,284 @@ int ems_show(unsigned int event_id, int fdOut) {
     fprintf(stderr, "Event not found\n");
     return 1;
   }
-//PRINT P WRITE
+
+  writer_put_uint(writer, (unsigned int)__atomic_load_n(&event->free_seats, __ATOMIC_RELAXED));
+  writer_put_char(writer, '\n');
+  return 0;
+}
+
+static int free_seats(unsigned int event_id, int fdOut) {
+  struct Writer writer;
+  writer_init(&writer, 32);
+
+  int result = render_free_seats(event_id, &writer);
+
+  if (result == 0) {
+    result = flush_output(&writer, fdOut);
+  }
+
+  writer_destroy(&writer);
+  return result;
+}
+
+static int render_show(unsigned int event_id, struct Writer* writer) {
+  if (lists == NULL) {
+    fprintf(stderr, "EMS state must be initialized\n");
+    return 1;
+  }
+
+  struct Event* event = get_event_with_delay(event_id);
+
+  if (event == NULL) {
+    fprintf(stderr, "Event not found\n");
+    return 1;
+  }
+
+  // Reservations bump the version once their seats are written, so output rendered at the
+  // version read here is at worst invalidated early.
+  unsigned int version = __atomic_load_n(&event->version, __ATOMIC_ACQUIRE);
+
+  if (show_cache_get(event, version, writer) == 0) {
+    stats_count(STATS_SHOW_CACHE_HITS);
+    return 0;
+  }
+
+  unsigned int* seats = malloc(event->rows * event->cols * sizeof(unsigned int));
+
+  if (seats == NULL) {
+    fprintf(stderr, "Error allocating memory for event data\n");
+    return 1;
+  }
+
+  // Read every seat in one go so the output is a consistent picture of the event, without blocking
+  // reservations. If they keep getting in the way, seats are read one by one under their seat
+  // locks instead, so a seat is never read halfway through the reservation writing it, although
+  // the picture may then mix seats from before and after a reservation. Lock-free reservations do
+  // not take seat locks, so with them seats claimed by a reservation still in progress may show up.
+  // Both share the event lock, which only keeps out block reservations writing whole rows without
+  // atomics.
+  if (shards_own_events) {
+    // The shard owning the event runs no reservation while it shows the event.
+    for (size_t i = 0; i < event->rows * event->cols; i++) {
+      seats[i] = get_seat_with_delay(event, i);
+    }
+  } else {
+    uint64_t span = trace_begin();
+    pthread_rwlock_rdlock(&event->lock);
+    trace_end("event lock", TRACE_WAIT, span);
+
+    // Only copies a reservation invalidated count as attempts; waiting for one to finish does not.
+    int result = 1;
+    for (size_t attempt = 0; attempt < SHOW_READ_ATTEMPTS && result == 1; attempt++) {
+      result = copy_seats_optimistic(event, seats, get_seat_with_delay);
+    }
+
+    if (result != 0) {
+      for (size_t i = 0; i < event->rows * event->cols; i++) {
+        seats[i] = get_seat_locked(event, i);
+      }
+    }
+    pthread_rwlock_unlock(&event->lock);
+  }
+
+  size_t start = writer->len;
+
   for (size_t i = 1; i <= event->rows; i++) {
     for (size_t j = 1; j <= event->cols; j++) {
-      unsigned int* seat = get_seat_with_delay(event, seat_index(event, i, j));
-      
-      sprintf(buffer, "%u", *seat);
-      write(fdOut, buffer, strlen(buffer));
+      writer_put_uint(writer, seats[seat_index(event, i, j)]);
 
       if (j < event->cols) {
-        write(fdOut, " ", 1);
+        writer_put_char(writer, ' ');
       }
     }
 
-    write(fdOut, "\n", 1);
+    writer_put_char(writer, '\n');
+  }
+
+  free(seats);
+
+  if (!writer->error) {
+    show_cache_put(event, version, writer->data + start, writer->len - start);
   }
 
   return 0;
 }
 
-int ems_list_events(int fdOut) {
+static int show(unsigned int event_id, int fdOut) {
+  struct Writer writer;
+  writer_init(&writer, 4096);
 
-  char buffer[128];
+  int result = render_show(event_id, &writer);
 
-  if (event_list == NULL) {
+  if (result == 0) {
+    result = flush_output(&writer, fdOut);
+  }
+
+  writer_destroy(&writer);
+  return result;
+}
+
+static int render_list_events(struct Writer* writer) {
+  if (lists == NULL) {
     fprintf(stderr, "EMS state must be initialized\n");
     return 1;
   }
-//PASSAR P WRITE
-  if (event_list->head == NULL) {
-    write(fdOut, "No events\n", 11);
-    return 0;
+
+  struct ListNode** cursors = malloc(num_lists * sizeof(struct ListNode*));
+
+  if (cursors == NULL) {
+    fprintf(stderr, "Error allocating memory for event list\n");
+    return 1;
+  }
+
+  // Nodes are only linked once complete and never unlinked, so the lists are walked without their
+  // locks and creates are never held up; events created meanwhile may or may not be listed.
+  size_t num_snapshot_events = snapshot_num_events(lists[0]->snapshot);
+  int empty = 1;
+
+  for (unsigned int i = 0; i < num_lists; i++) {
+    cursors[i] = __atomic_load_n(&lists[i]->head, __ATOMIC_ACQUIRE);
+    empty &= cursors[i] == NULL;
   }
-//PRINTFS P WRITES
-  struct ListNode* current = event_list->head;
-  while (current != NULL) {
-    write(fdOut, "Event: ", 7);
 
-    sprintf(buffer,"%u\n", (current->event)->id);
+  if (empty && num_snapshot_events == 0) {
+    writer_put(writer, "No events\n", 11);
+  }
+
+  // Events of the snapshot were created before any in the lists.
+  for (size_t i = 0; i < num_snapshot_events; i++) {
+    writer_put(writer, "Event: ", 7);
+    writer_put_uint(writer, snapshot_event_id(lists[0]->snapshot, i));
+    writer_put_char(writer, '\n');
+  }
 
-    write(fdOut, buffer, strlen(buffer));
-    current = current->next;
+  // With shards, each list holds the events of one of them, merged back in the order of creation.
+  for (struct ListNode* node; (node = next_created(cursors, num_lists)) != NULL;) {
+    writer_put(writer, "Event: ", 7);
+    writer_put_uint(writer, node->event->id);
+    writer_put_char(writer, '\n');
   }
 
+  free(cursors);
   return 0;
 }
 
+static int list_events(int fdOut) {
+  struct Writer writer;
+  writer_init(&writer, 4096);
+
+  int result = render_list_events(&writer);
+
+  if (result == 0) {
+    result = flush_output(&writer, fdOut);
+  }
+
+  writer_destroy(&writer);
+  return result;
+}
+
+int ems_create(unsigned int event_id, size_t num_rows, size_t num_cols) {
+  uint64_t start = stats_start();
+  uint64_t span = trace_begin();
+  int result = create(event_id, num_rows, num_cols);
+  stats_record(STATS_CREATE, start);
+  trace_end("ems_create", TRACE_EMS, span);
+  return result;
+}
+
+int ems_reserve(unsigned int event_id, size_t num_seats, size_t* xs, size_t* ys) {
+  uint64_t start = stats_start();
+  uint64_t span = trace_begin();
+  int result = reserve(event_id, num_seats, xs, ys);
+  stats_record(STATS_RESERVE, start);
+  trace_end("ems_reserve", TRACE_EMS, span);
+  return result;
+}
+
+int ems_reserve_best(unsigned int event_id, size_t num_seats, int fdOut) {
+  uint64_t start = stats_start();
+  uint64_t span = trace_begin();
+  int result = reserve_best(event_id, num_seats, fdOut);
+  stats_record(STATS_RESERVE_BEST, start);
+  trace_end("ems_reserve_best", TRACE_EMS, span);
+  return result;
+}
+
+int ems_reserve_block(unsigned int event_id, size_t first_row, size_t first_col, size_t last_row, size_t last_col) {
+  uint64_t start = stats_start();
+  uint64_t span = trace_begin();
+  int result = reserve_block(event_id, first_row, first_col, last_row, last_col);
+  stats_record(STATS_RESERVE_BLOCK, start);
+  trace_end("ems_reserve_block", TRACE_EMS, span);
+  return result;
+}
+
+int ems_free_seats(unsigned int event_id, int fdOut) {
+  uint64_t start = stats_start();
+  uint64_t span = trace_begin();
+  int result = free_seats(event_id, fdOut);
+  stats_record(STATS_FREE_SEATS, start);
+  trace_end("ems_free_seats", TRACE_EMS, span);
+  return result;
+}
+
+int ems_show(unsigned int event_id, int fdOut) {
+  uint64_t start = stats_start();
+  uint64_t span = trace_begin();
+  int result = show(event_id, fdOut);
+  stats_record(STATS_SHOW, start);
+  trace_end("ems_show", TRACE_EMS, span);
+  return result;
+}
+
+int ems_list_events(int fdOut) {
+  uint64_t start = stats_start();
+  uint64_t span = trace_begin();
+  int result = list_events(fdOut);
+  stats_record(STATS_LIST_EVENTS, start);
+  trace_end("ems_list_events", TRACE_EMS, span);
+  return result;
+}
+
+int ems_render_show(unsigned int event_id, struct Writer* writer) {
+  uint64_t start = stats_start();
+  uint64_t span = trace_begin();
+  int result = render_show(event_id, writer);
+  stats_record(STATS_SHOW, start);
+  trace_end("ems_render_show", TRACE_EMS, span);
+  return result;
+}
+
+int ems_render_reserve_best(unsigned int event_id, size_t num_seats, struct Writer* writer) {
+  uint64_t start = stats_start();
+  uint64_t span = trace_begin();
+  int result = render_reserve_best(event_id, num_seats, writer);
+  stats_record(STATS_RESERVE_BEST, start);
+  trace_end("ems_render_reserve_best", TRACE_EMS, span);
+  return result;
+}
+
+int ems_render_free_seats(unsigned int event_id, struct Writer* writer) {
+  uint64_t start = stats_start();
+  uint64_t span = trace_begin();
+  int result = render_free_seats(event_id, writer);
+  stats_record(STATS_FREE_SEATS, start);
+  trace_end("ems_render_free_seats", TRACE_EMS, span);
+  return result;
+}
+
+int ems_render_list_events(struct Writer* writer) {
+  uint64_t start = stats_start();
+  uint64_t span = trace_begin();
+  int result = render_list_events(writer);
+  stats_record(STATS_LIST_EVENTS, start);
+  trace_end("ems_render_list_events", TRACE_EMS, span);
+  return result;
+}
+
 void ems_wait(unsigned int delay_ms) {
+  uint64_t span = trace_begin();
   struct timespec delay = delay_to_timespec(delay_ms);
   nanosleep(&delay, NULL);
+  trace_end("ems_wait", TRACE_EMS, span);
 }
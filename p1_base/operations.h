@@ -3,11 +3,58 @@
 
 #include <stddef.h>
 
-/// Initializes the EMS state.
+struct Writer;
+
+/// Ways ems_reserve can claim seats.
+enum ReserveEngine {
+  RESERVE_LOCKED,    /// Seats are checked and claimed under the seat locks of the event.
+  RESERVE_LOCK_FREE  /// Seats are claimed one by one with compare-and-swap, rolled back on conflict.
+};
+
+/// Selects how ems_reserve claims seats. Defaults to RESERVE_LOCKED.
+/// @note Should be called before any reservation is made.
+/// @param engine Engine to use.
+void ems_set_reserve_engine(enum ReserveEngine engine);
+
+/// Splits the events between shards, each with an event table and arena of its own, event e
+/// belonging to shard e % num_shards. Every operation on an event is then expected to run on the
+/// thread of its shard, so creates, reservations and SHOW take no lock and ignore the engine
+/// selected; LIST merges the tables back in the order the events were created.
+/// @note Must be called before ems_init.
+/// @param num_shards Number of shards, at least 1.
+void ems_set_shards(unsigned int num_shards);
+
+/// Sets how many bytes ems_show may keep to serve unchanged events without reading their seats.
+/// Defaults to SHOW_CACHE_BYTES; 0 disables the cache.
+/// @note Should be called before any event is shown.
+/// @param bytes Memory budget of the cache.
+void ems_set_show_cache_size(size_t bytes);
+
+/// Makes ems_init start from a snapshot written by ems_write_snapshot. The snapshot is mapped
+/// rather than read, so startup takes the same time whatever its size.
+/// @note Should be called before ems_init.
+/// @param path Path of the snapshot.
+void ems_set_snapshot(const char *path);
+
+/// Makes successful creations and reservations durable in a write-ahead log, which ems_init
+/// replays to rebuild the state. Starting from a snapshot, only the part of the log written after
+/// it is replayed.
+/// @note Should be called before ems_init.
+/// @param path Path of the log.
+/// @param window_us How long a commit waits for others to share its fsync, in microseconds.
+void ems_set_log(const char *path, unsigned int window_us);
+
+/// Initializes the EMS state, replaying the log if one was set with ems_set_log.
 /// @param delay_ms State access delay in milliseconds.
 /// @return 0 if the EMS state was initialized successfully, 1 otherwise.
 int ems_init(unsigned int delay_ms);
 
+/// Writes every event and its seats to a snapshot that ems_set_snapshot can start from.
+/// @note Should only be called while no other operation is running.
+/// @param path Path of the snapshot.
+/// @return 0 if the snapshot was written successfully, 1 otherwise.
+int ems_write_snapshot(const char *path);
+
 /// Destroys the EMS state.
 int ems_terminate();
 
@@ -26,6 +73,29 @@ int ems_create(unsigned int event_id, size_t num_rows, size_t num_cols);
 /// @return 0 if the reservation was created successfully, 1 otherwise.
 int ems_reserve(unsigned int event_id, size_t num_seats, size_t *xs, size_t *ys);
 
+/// Reserves the first num_seats adjacent free seats of the given event, looking at rows front to
+/// back, and prints the seats assigned as (row,col) pairs.
+/// @param event_id Id of the event to create a reservation for.
+/// @param num_seats Number of adjacent seats to reserve.
+/// @param fdOut File descriptor to print the seats assigned to.
+/// @return 0 if the reservation was created successfully, 1 otherwise.
+int ems_reserve_best(unsigned int event_id, size_t num_seats, int fdOut);
+
+/// Reserves every seat of a rectangle of the given event, or none of them.
+/// @note A single row makes a range of adjacent seats.
+/// @param event_id Id of the event to create a reservation for.
+/// @param first_row Row of the top left seat.
+/// @param first_col Column of the top left seat.
+/// @param last_row Row of the bottom right seat.
+/// @param last_col Column of the bottom right seat.
+/// @return 0 if the reservation was created successfully, 1 otherwise.
+int ems_reserve_block(unsigned int event_id, size_t first_row, size_t first_col, size_t last_row, size_t last_col);
+
+/// Prints the number of free seats of the given event.
+/// @param event_id Id of the event.
+/// @return 0 if the count was printed successfully, 1 otherwise.
+int ems_free_seats(unsigned int event_id, int fdOut);
+
 /// Prints the given event.
 /// @param event_id Id of the event to print.
 /// @return 0 if the event was printed successfully, 1 otherwise.
@@ -35,6 +105,30 @@ int ems_show(unsigned int event_id, int fdOut);
 /// @return 0 if the events were printed successfully, 1 otherwise.
 int ems_list_events(int fdOut);
 
+/// Renders the given event into a writer, as ems_show would print it.
+/// @param event_id Id of the event to render.
+/// @param writer Writer to append the event to.
+/// @return 0 if the event was rendered successfully, 1 otherwise.
+int ems_render_show(unsigned int event_id, struct Writer *writer);
+
+/// Reserves seats as ems_reserve_best does, rendering the seats assigned into a writer.
+/// @param event_id Id of the event to create a reservation for.
+/// @param num_seats Number of adjacent seats to reserve.
+/// @param writer Writer to append the seats assigned to.
+/// @return 0 if the reservation was created successfully, 1 otherwise.
+int ems_render_reserve_best(unsigned int event_id, size_t num_seats, struct Writer *writer);
+
+/// Renders the number of free seats of the given event into a writer, as ems_free_seats would print it.
+/// @param event_id Id of the event.
+/// @param writer Writer to append the count to.
+/// @return 0 if the count was rendered successfully, 1 otherwise.
+int ems_render_free_seats(unsigned int event_id, struct Writer *writer);
+
+/// Renders all the events into a writer, as ems_list_events would print them.
+/// @param writer Writer to append the events to.
+/// @return 0 if the events were rendered successfully, 1 otherwise.
+int ems_render_list_events(struct Writer *writer);
+
 /// Waits for a given amount of time.
 /// @param delay_us Delay in milliseconds.
 void ems_wait(unsigned int delay_ms);
@@ -1,18 +1,244 @@
 #include "parser.h"
 
 #include <limits.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
 #include "constants.h"
 
+/// Read buffer of a job file descriptor, refilled a block at a time.
+struct Reader {
+  size_t pos;     // Next byte to hand out
+  size_t len;     // Number of bytes in the buffer
+  int binary;     // Whether the file is a compiled job file
+  int malformed;  // Whether the arguments of the last compiled command failed to parse
+  int thread;     // Whether the last compiled command carries a thread id
+  char buf[READER_BUFFER_SIZE];
+};
+
+/// Readers indexed by file descriptor. Every descriptor is read by a single thread, but a closed
+/// descriptor number may be reused by another thread, so slots are accessed atomically.
+static struct Reader *readers[MAX_READERS];
+
+/// Gets the reader of a file descriptor, creating it on first use.
+/// @return The reader, NULL if the descriptor cannot be buffered.
+static struct Reader *get_reader(int fd) {
+  if (fd < 0 || fd >= MAX_READERS) {
+    return NULL;
+  }
+
+  struct Reader *reader = __atomic_load_n(&readers[fd], __ATOMIC_ACQUIRE);
+
+  if (reader == NULL) {
+    reader = malloc(sizeof(struct Reader));
+    if (reader == NULL) {
+      return NULL;
+    }
+
+    reader->pos = 0;
+    reader->len = 0;
+    reader->binary = 0;
+    reader->malformed = 0;
+    reader->thread = 0;
+
+    // Tell compiled job files apart by their header, which no text command starts with.
+    ssize_t n = read(fd, reader->buf, READER_BUFFER_SIZE);
+    if (n > 0) {
+      reader->len = (size_t)n;
+    }
+
+    if (reader->len >= BINARY_JOBS_MAGIC_LEN && memcmp(reader->buf, BINARY_JOBS_MAGIC, BINARY_JOBS_MAGIC_LEN) == 0) {
+      reader->binary = 1;
+      reader->pos = BINARY_JOBS_MAGIC_LEN;
+    }
+
+    __atomic_store_n(&readers[fd], reader, __ATOMIC_RELEASE);
+  }
+
+  return reader;
+}
+
+/// Reads up to count bytes, refilling the buffer of the descriptor as needed.
+/// @note Behaves like read, but only returns less than count at the end of the file.
+/// @return Number of bytes read.
+static size_t buffered_read(int fd, char *dst, size_t count) {
+  struct Reader *reader = get_reader(fd);
+
+  if (reader == NULL) {
+    ssize_t n = read(fd, dst, count);
+    return n < 0 ? 0 : (size_t)n;
+  }
+
+  size_t done = 0;
+  while (done < count) {
+    if (reader->pos == reader->len) {
+      ssize_t n = read(fd, reader->buf, READER_BUFFER_SIZE);
+      if (n <= 0) {
+        break;
+      }
+      reader->pos = 0;
+      reader->len = (size_t)n;
+    }
+
+    size_t chunk = reader->len - reader->pos;
+    if (chunk > count - done) {
+      chunk = count - done;
+    }
+
+    memcpy(dst + done, reader->buf + reader->pos, chunk);
+    reader->pos += chunk;
+    done += chunk;
+  }
+
+  return done;
+}
+
+/// Reads a single byte.
+/// @return 1 if a byte was read, 0 at the end of the file.
+static inline int read_char(int fd, char *ch) {
+  if (fd >= 0 && fd < MAX_READERS) {
+    struct Reader *reader = __atomic_load_n(&readers[fd], __ATOMIC_ACQUIRE);
+
+    if (reader != NULL && reader->pos < reader->len) {
+      *ch = reader->buf[reader->pos++];
+      return 1;
+    }
+  }
+
+  return buffered_read(fd, ch, 1) == 1;
+}
+
+void parser_release(int fd) {
+  if (fd < 0 || fd >= MAX_READERS) {
+    return;
+  }
+
+  free(__atomic_exchange_n(&readers[fd], NULL, __ATOMIC_ACQ_REL));
+}
+
+/// Gets the reader of a compiled job file.
+/// @return The reader, NULL if the file is a text job file.
+static struct Reader *binary_reader(int fd) {
+  struct Reader *reader = get_reader(fd);
+  return reader != NULL && reader->binary ? reader : NULL;
+}
+
+/// Reads a LEB128 varint from a compiled job file.
+/// @return 0 if a value was read, 1 at the end of the file or if the value does not fit.
+static int read_varint(int fd, uint64_t *value) {
+  uint64_t result = 0;
+  unsigned int shift = 0;
+  char ch;
+
+  do {
+    if (shift > 63 || read_char(fd, &ch) != 1) {
+      return 1;
+    }
+
+    result |= (uint64_t)((unsigned char)ch & 0x7F) << shift;
+    shift += 7;
+  } while ((unsigned char)ch & 0x80);
+
+  *value = result;
+  return 0;
+}
+
+/// Reads a varint that must fit an unsigned int.
+/// @return 0 if a value was read, 1 otherwise.
+static int read_varint_uint(int fd, unsigned int *value) {
+  uint64_t v;
+
+  if (read_varint(fd, &v) != 0 || v > UINT_MAX) {
+    return 1;
+  }
+
+  *value = (unsigned int)v;
+  return 0;
+}
+
+/// Reads the opcode of the next compiled command.
+static enum Command binary_get_next(int fd, struct Reader *reader) {
+  char ch;
+
+  if (read_char(fd, &ch) != 1) {
+    return EOC;
+  }
+
+  unsigned int opcode = (unsigned char)ch;
+  reader->malformed = (opcode & BINARY_JOBS_MALFORMED) != 0;
+  reader->thread = (opcode & BINARY_JOBS_THREAD) != 0;
+  opcode &= ~(unsigned int)(BINARY_JOBS_MALFORMED | BINARY_JOBS_THREAD);
+
+  if (opcode >= EOC || (reader->thread && opcode != CMD_WAIT)) {
+    reader->malformed = 0;
+    reader->thread = 0;
+    return CMD_INVALID;
+  }
+
+  return (enum Command)opcode;
+}
+
+/// Skips the arguments of a compiled command.
+static void binary_skip(int fd, struct Reader *reader, enum Command cmd) {
+  uint64_t count = 0, value;
+
+  if (reader->malformed) {
+    return;
+  }
+
+  switch (cmd) {
+    case CMD_CREATE:
+      count = 3;
+      break;
+
+    case CMD_RESERVE:
+      if (read_varint(fd, &value) != 0 || read_varint(fd, &count) != 0) {
+        return;
+      }
+      count *= 2;
+      break;
+
+    case CMD_SHOW:
+    case CMD_SEATS:
+      count = 1;
+      break;
+
+    case CMD_WAIT:
+      count = reader->thread ? 2 : 1;
+      break;
+
+    case CMD_RESERVE_BEST:
+      count = 2;
+      break;
+
+    case CMD_RESERVE_RANGE:
+      count = 4;
+      break;
+
+    case CMD_RESERVE_BLOCK:
+      count = 5;
+      break;
+
+    case CMD_LIST_EVENTS:
+    case CMD_BARRIER:
+    case CMD_HELP:
+    case CMD_EMPTY:
+    case CMD_INVALID:
+    case EOC:
+      break;
+  }
+
+  for (uint64_t i = 0; i < count && read_varint(fd, &value) == 0; i++);
+}
+
 static int read_uint(int fd, unsigned int *value, char *next) {
   char buf[16];
 
   int i = 0;
   while (1) {
-    if (read(fd, buf + i, 1) == 0) {
+    if (read_char(fd, buf + i) == 0) {
       *next = '\0';
       break;
     }
@@ -40,18 +266,23 @@ static int read_uint(int fd, unsigned int *value, char *next) {
 
 static void cleanup(int fd) {
   char ch;
-  while (read(fd, &ch, 1) == 1 && ch != '\n');
+  while (read_char(fd, &ch) == 1 && ch != '\n');
 }
 
 enum Command get_next(int fd) {
+  struct Reader *reader = binary_reader(fd);
+  if (reader != NULL) {
+    return binary_get_next(fd, reader);
+  }
+
   char buf[16];
-  if (read(fd, buf, 1) != 1) {
+  if (read_char(fd, buf) != 1) {
     return EOC;
   }
 
   switch (buf[0]) {
     case 'C':
-      if (read(fd, buf + 1, 6) != 6 || strncmp(buf, "CREATE ", 7) != 0) {
+      if (buffered_read(fd, buf + 1, 6) != 6 || strncmp(buf, "CREATE ", 7) != 0) {
         cleanup(fd);
         return CMD_INVALID;
       }
@@ -59,28 +290,64 @@ enum Command get_next(int fd) {
       return CMD_CREATE;
 
     case 'R':
-      if (read(fd, buf + 1, 7) != 7 || strncmp(buf, "RESERVE ", 8) != 0) {
+      if (buffered_read(fd, buf + 1, 7) != 7 || strncmp(buf, "RESERVE", 7) != 0) {
+        cleanup(fd);
+        return CMD_INVALID;
+      }
+
+      if (buf[7] == ' ') {
+        return CMD_RESERVE;
+      }
+
+      if (buf[7] != '_' || buffered_read(fd, buf + 8, 5) != 5) {
         cleanup(fd);
         return CMD_INVALID;
       }
 
-      return CMD_RESERVE;
+      if (strncmp(buf, "RESERVE_BEST ", 13) == 0) {
+        return CMD_RESERVE_BEST;
+      }
+
+      if (buffered_read(fd, buf + 13, 1) != 1 || buf[13] != ' ') {
+        cleanup(fd);
+        return CMD_INVALID;
+      }
+
+      if (strncmp(buf, "RESERVE_RANGE", 13) == 0) {
+        return CMD_RESERVE_RANGE;
+      }
+
+      if (strncmp(buf, "RESERVE_BLOCK", 13) == 0) {
+        return CMD_RESERVE_BLOCK;
+      }
+
+      cleanup(fd);
+      return CMD_INVALID;
 
     case 'S':
-      if (read(fd, buf + 1, 4) != 4 || strncmp(buf, "SHOW ", 5) != 0) {
+      if (buffered_read(fd, buf + 1, 4) != 4) {
+        cleanup(fd);
+        return CMD_INVALID;
+      }
+
+      if (strncmp(buf, "SHOW ", 5) == 0) {
+        return CMD_SHOW;
+      }
+
+      if (strncmp(buf, "SEATS", 5) != 0 || buffered_read(fd, buf + 5, 1) != 1 || buf[5] != ' ') {
         cleanup(fd);
         return CMD_INVALID;
       }
 
-      return CMD_SHOW;
+      return CMD_SEATS;
 
     case 'L':
-      if (read(fd, buf + 1, 3) != 3 || strncmp(buf, "LIST", 4) != 0) {
+      if (buffered_read(fd, buf + 1, 3) != 3 || strncmp(buf, "LIST", 4) != 0) {
         cleanup(fd);
         return CMD_INVALID;
       }
 
-      if (read(fd, buf + 4, 1) != 0 && buf[4] != '\n') {
+      if (buffered_read(fd, buf + 4, 1) != 0 && buf[4] != '\n') {
         cleanup(fd);
         return CMD_INVALID;
       }
@@ -88,12 +355,12 @@ enum Command get_next(int fd) {
       return CMD_LIST_EVENTS;
 
     case 'B':
-      if (read(fd, buf + 1, 6) != 6 || strncmp(buf, "BARRIER", 7) != 0) {
+      if (buffered_read(fd, buf + 1, 6) != 6 || strncmp(buf, "BARRIER", 7) != 0) {
         cleanup(fd);
         return CMD_INVALID;
       }
 
-      if (read(fd, buf + 7, 1) != 0 && buf[7] != '\n') {
+      if (buffered_read(fd, buf + 7, 1) != 0 && buf[7] != '\n') {
         cleanup(fd);
         return CMD_INVALID;
       }
@@ -101,7 +368,7 @@ enum Command get_next(int fd) {
       return CMD_BARRIER;
 
     case 'W':
-      if (read(fd, buf + 1, 4) != 4 || strncmp(buf, "WAIT ", 5) != 0) {
+      if (buffered_read(fd, buf + 1, 4) != 4 || strncmp(buf, "WAIT ", 5) != 0) {
         cleanup(fd);
         return CMD_INVALID;
       }
@@ -109,12 +376,12 @@ enum Command get_next(int fd) {
       return CMD_WAIT;
 
     case 'H':
-      if (read(fd, buf + 1, 3) != 3 || strncmp(buf, "HELP", 4) != 0) {
+      if (buffered_read(fd, buf + 1, 3) != 3 || strncmp(buf, "HELP", 4) != 0) {
         cleanup(fd);
         return CMD_INVALID;
       }
 
-      if (read(fd, buf + 4, 1) != 0 && buf[4] != '\n') {
+      if (buffered_read(fd, buf + 4, 1) != 0 && buf[4] != '\n') {
         cleanup(fd);
         return CMD_INVALID;
       }
@@ -134,7 +401,50 @@ enum Command get_next(int fd) {
   }
 }
 
+void skip_command(int fd, enum Command cmd) {
+  struct Reader *reader = binary_reader(fd);
+  if (reader != NULL) {
+    binary_skip(fd, reader, cmd);
+    return;
+  }
+
+  switch (cmd) {
+    case CMD_CREATE:
+    case CMD_RESERVE:
+    case CMD_SHOW:
+    case CMD_WAIT:
+    case CMD_RESERVE_BEST:
+    case CMD_SEATS:
+    case CMD_RESERVE_RANGE:
+    case CMD_RESERVE_BLOCK:
+      cleanup(fd);
+      break;
+
+    case CMD_LIST_EVENTS:
+    case CMD_BARRIER:
+    case CMD_HELP:
+    case CMD_EMPTY:
+    case CMD_INVALID:
+    case EOC:
+      break;
+  }
+}
+
 int parse_create(int fd, unsigned int *event_id, size_t *num_rows, size_t *num_cols) {
+  struct Reader *reader = binary_reader(fd);
+  if (reader != NULL) {
+    unsigned int u_num_rows, u_num_cols;
+
+    if (reader->malformed || read_varint_uint(fd, event_id) != 0 || read_varint_uint(fd, &u_num_rows) != 0 ||
+        read_varint_uint(fd, &u_num_cols) != 0) {
+      return 1;
+    }
+
+    *num_rows = (size_t)u_num_rows;
+    *num_cols = (size_t)u_num_cols;
+    return 0;
+  }
+
   char ch;
 
   if (read_uint(fd, event_id, &ch) != 0 || ch != ' ') {
@@ -160,6 +470,32 @@ int parse_create(int fd, unsigned int *event_id, size_t *num_rows, size_t *num_c
 }
 
 size_t parse_reserve(int fd, size_t max, unsigned int *event_id, size_t *xs, size_t *ys) {
+  struct Reader *reader = binary_reader(fd);
+  if (reader != NULL) {
+    uint64_t num_coords;
+
+    if (reader->malformed || read_varint_uint(fd, event_id) != 0 || read_varint(fd, &num_coords) != 0) {
+      return 0;
+    }
+
+    // Compiled files come from parse_reserve, so the bound only matters for a smaller max.
+    int too_many = num_coords >= max;
+    for (uint64_t i = 0; i < num_coords; i++) {
+      unsigned int x, y;
+
+      if (read_varint_uint(fd, &x) != 0 || read_varint_uint(fd, &y) != 0) {
+        return 0;
+      }
+
+      if (!too_many) {
+        xs[i] = (size_t)x;
+        ys[i] = (size_t)y;
+      }
+    }
+
+    return too_many ? 0 : (size_t)num_coords;
+  }
+
   char ch;
 
   if (read_uint(fd, event_id, &ch) != 0 || ch != ' ') {
@@ -167,14 +503,14 @@ size_t parse_reserve(int fd, size_t max, unsigned int *event_id, size_t *xs, siz
     return 0;
   }
 
-  if (read(fd, &ch, 1) != 1 || ch != '[') {
+  if (read_char(fd, &ch) != 1 || ch != '[') {
     cleanup(fd);
     return 0;
   }
 
   size_t num_coords = 0;
   while (num_coords < max) {
-    if (read(fd, &ch, 1) != 1 || ch != '(') {
+    if (read_char(fd, &ch) != 1 || ch != '(') {
       cleanup(fd);
       return 0;
     }
@@ -195,7 +531,7 @@ size_t parse_reserve(int fd, size_t max, unsigned int *event_id, size_t *xs, siz
 
     num_coords++;
 
-    if (read(fd, &ch, 1) != 1 || (ch != ' ' && ch != ']')) {
+    if (read_char(fd, &ch) != 1 || (ch != ' ' && ch != ']')) {
       cleanup(fd);
       return 0;
     }
@@ -210,7 +546,7 @@ size_t parse_reserve(int fd, size_t max, unsigned int *event_id, size_t *xs, siz
     return 0;
   }
 
-  if (read(fd, &ch, 1) != 1 || (ch != '\n' && ch != '\0')) {
+  if (read_char(fd, &ch) != 1 || (ch != '\n' && ch != '\0')) {
     cleanup(fd);
     return 0;
   }
@@ -218,7 +554,91 @@ size_t parse_reserve(int fd, size_t max, unsigned int *event_id, size_t *xs, siz
   return num_coords;
 }
 
+int parse_reserve_best(int fd, size_t max, unsigned int *event_id, size_t *num_seats) {
+  unsigned int u_num_seats;
+
+  struct Reader *reader = binary_reader(fd);
+  if (reader != NULL) {
+    if (reader->malformed || read_varint_uint(fd, event_id) != 0 || read_varint_uint(fd, &u_num_seats) != 0) {
+      return 1;
+    }
+  } else {
+    char ch;
+
+    if (read_uint(fd, event_id, &ch) != 0 || ch != ' ') {
+      cleanup(fd);
+      return 1;
+    }
+
+    if (read_uint(fd, &u_num_seats, &ch) != 0 || (ch != '\n' && ch != '\0')) {
+      cleanup(fd);
+      return 1;
+    }
+  }
+
+  if (u_num_seats == 0 || u_num_seats > max) {
+    return 1;
+  }
+
+  *num_seats = (size_t)u_num_seats;
+  return 0;
+}
+
+int parse_reserve_block(int fd, enum Command cmd, unsigned int *event_id, size_t *first_row, size_t *first_col,
+                        size_t *last_row, size_t *last_col) {
+  // RESERVE_RANGE names a single row, which is both the first and the last.
+  unsigned int values[4];
+  size_t num_values = cmd == CMD_RESERVE_BLOCK ? 4 : 3;
+
+  struct Reader *reader = binary_reader(fd);
+  if (reader != NULL) {
+    if (reader->malformed || read_varint_uint(fd, event_id) != 0) {
+      return 1;
+    }
+
+    for (size_t i = 0; i < num_values; i++) {
+      if (read_varint_uint(fd, &values[i]) != 0) {
+        return 1;
+      }
+    }
+  } else {
+    char ch;
+
+    if (read_uint(fd, event_id, &ch) != 0 || ch != ' ') {
+      cleanup(fd);
+      return 1;
+    }
+
+    for (size_t i = 0; i < num_values; i++) {
+      char expected = i + 1 < num_values ? ' ' : '\n';
+
+      if (read_uint(fd, &values[i], &ch) != 0 || (ch != expected && (expected != '\n' || ch != '\0'))) {
+        cleanup(fd);
+        return 1;
+      }
+    }
+  }
+
+  *first_row = (size_t)values[0];
+  *first_col = (size_t)values[1];
+
+  if (cmd == CMD_RESERVE_BLOCK) {
+    *last_row = (size_t)values[2];
+    *last_col = (size_t)values[3];
+  } else {
+    *last_row = (size_t)values[0];
+    *last_col = (size_t)values[2];
+  }
+
+  return 0;
+}
+
 int parse_show(int fd, unsigned int *event_id) {
+  struct Reader *reader = binary_reader(fd);
+  if (reader != NULL) {
+    return reader->malformed || read_varint_uint(fd, event_id) != 0;
+  }
+
   char ch;
 
   if (read_uint(fd, event_id, &ch) != 0 || (ch != '\n' && ch != '\0')) {
@@ -230,6 +650,23 @@ int parse_show(int fd, unsigned int *event_id) {
 }
 
 int parse_wait(int fd, unsigned int *delay, unsigned int *thread_id) {
+  struct Reader *reader = binary_reader(fd);
+  if (reader != NULL) {
+    unsigned int thread;
+
+    if (reader->malformed || read_varint_uint(fd, delay) != 0 ||
+        (reader->thread && read_varint_uint(fd, &thread) != 0)) {
+      return -1;
+    }
+
+    if (!reader->thread || thread_id == NULL) {
+      return 0;
+    }
+
+    *thread_id = thread;
+    return 1;
+  }
+
   char ch;
 
   if (read_uint(fd, delay, &ch) != 0) {
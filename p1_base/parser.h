@@ -3,6 +3,23 @@
 
 #include <stddef.h>
 
+/// Header of a compiled job file. A compiled file is a sequence of commands, each an opcode byte
+/// holding the Command value and flags, followed by its arguments as LEB128 varints:
+///   CREATE   event_id num_rows num_cols
+///   RESERVE  event_id num_coords x1 y1 x2 y2 ...
+///   SHOW     event_id
+///   WAIT     delay_ms [thread_id] (present when BINARY_JOBS_THREAD is set)
+///   RESERVE_BEST  event_id num_seats
+///   SEATS    event_id
+///   RESERVE_RANGE  event_id row first_col last_col
+///   RESERVE_BLOCK  event_id first_row first_col last_row last_col
+/// Commands whose arguments failed to parse have BINARY_JOBS_MALFORMED set and no arguments, so
+/// that they fail the same way when executed. Empty lines and comments are left out.
+#define BINARY_JOBS_MAGIC "EMSB\x02"
+#define BINARY_JOBS_MAGIC_LEN 5
+#define BINARY_JOBS_MALFORMED 0x80
+#define BINARY_JOBS_THREAD 0x40  // A WAIT names the thread that is to wait
+
 enum Command {
   CMD_CREATE,
   CMD_RESERVE,
@@ -13,14 +30,32 @@ enum Command {
   CMD_HELP,
   CMD_EMPTY,
   CMD_INVALID,
+  CMD_RESERVE_BEST,
+  CMD_SEATS,
+  CMD_RESERVE_RANGE,
+  CMD_RESERVE_BLOCK,
   EOC  // End of commands
 };
 
+/// Releases the read buffer kept for a file descriptor.
+/// @note parser_release(fd) must come before close(fd) for every descriptor the parser has read
+/// from. Otherwise the buffer stays attached to the descriptor number, and the next file opened
+/// with that number silently gets the bytes buffered for the previous one.
+/// @param fd File descriptor to release.
+void parser_release(int fd);
+
 /// Reads a line and returns the corresponding command.
+/// @note Compiled job files are detected on the first read and decoded transparently by this and
+/// every parse function below.
 /// @param fd File descriptor to read from.
 /// @return The command read.
 enum Command get_next(int fd);
 
+/// Skips the arguments of a command returned by get_next without parsing them.
+/// @param fd File descriptor to read from.
+/// @param cmd Command whose arguments are to be skipped.
+void skip_command(int fd, enum Command cmd);
+
 /// Parses a CREATE command.
 /// @param fd File descriptor to read from.
 /// @param event_id Pointer to the variable to store the event ID in.
@@ -38,7 +73,28 @@ int parse_create(int fd, unsigned int *event_id, size_t *num_rows, size_t *num_c
 /// @return Number of coordinates read. 0 on failure.
 size_t parse_reserve(int fd, size_t max, unsigned int *event_id, size_t *xs, size_t *ys);
 
-/// Parses a SHOW command.
+/// Parses a RESERVE_BEST command.
+/// @param fd File descriptor to read from.
+/// @param max Maximum number of seats that may be requested.
+/// @param event_id Pointer to the variable to store the event ID in.
+/// @param num_seats Pointer to the variable to store the number of seats in.
+/// @return 0 if the command was parsed successfully, 1 otherwise.
+int parse_reserve_best(int fd, size_t max, unsigned int *event_id, size_t *num_seats);
+
+/// Parses a RESERVE_RANGE command, a run of seats of one row, or a RESERVE_BLOCK command, a
+/// rectangle of seats given by two opposite corners.
+/// @param fd File descriptor to read from.
+/// @param cmd Command returned by get_next, CMD_RESERVE_RANGE or CMD_RESERVE_BLOCK.
+/// @param event_id Pointer to the variable to store the event ID in.
+/// @param first_row Pointer to the variable to store the first row in.
+/// @param first_col Pointer to the variable to store the first column in.
+/// @param last_row Pointer to the variable to store the last row in, the first one for a range.
+/// @param last_col Pointer to the variable to store the last column in.
+/// @return 0 if the command was parsed successfully, 1 otherwise.
+int parse_reserve_block(int fd, enum Command cmd, unsigned int *event_id, size_t *first_row, size_t *first_col,
+                        size_t *last_row, size_t *last_col);
+
+/// Parses a SHOW or SEATS command.
 /// @param fd File descriptor to read from.
 /// @param event_id Pointer to the variable to store the event ID in.
 /// @return 0 if the command was parsed successfully, 1 otherwise.
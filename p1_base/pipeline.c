@@ -0,0 +1,276 @@
+#include "pipeline.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "command.h"
+#include "constants.h"
+#include "operations.h"
+#include "trace.h"
+#include "writer.h"
+
+/// Bounded ring of fixed-size slots between one producer and one consumer. Slots are filled and
+/// read in place; the lock only guards the counts.
+struct Ring {
+  char *slots;
+  size_t slot_size;
+  size_t head;
+  size_t count;
+  int closed;  // Set by the producer once nothing else will be published
+  pthread_mutex_t lock;
+  pthread_cond_t changed;
+};
+
+/// Stages of a job file.
+struct Pipeline {
+  struct Ring commands;  // Parsed commands, from the parse stage to the execute stage
+  struct Ring output;    // Rendered output, from the execute stage to the write stage
+  int fdOut;
+};
+
+static int ring_init(struct Ring *ring, size_t slot_size) {
+  ring->slots = malloc(PIPELINE_DEPTH * slot_size);
+
+  if (ring->slots == NULL) {
+    return 1;
+  }
+
+  ring->slot_size = slot_size;
+  ring->head = 0;
+  ring->count = 0;
+  ring->closed = 0;
+  pthread_mutex_init(&ring->lock, NULL);
+  pthread_cond_init(&ring->changed, NULL);
+  return 0;
+}
+
+static void ring_destroy(struct Ring *ring) {
+  pthread_mutex_destroy(&ring->lock);
+  pthread_cond_destroy(&ring->changed);
+  free(ring->slots);
+}
+
+/// Gets the next free slot for the producer to fill, waiting while the ring is full.
+/// @note The slot is only handed over by ring_publish; until then it may be refilled or dropped.
+static void *ring_acquire(struct Ring *ring) {
+  pthread_mutex_lock(&ring->lock);
+
+  while (ring->count == PIPELINE_DEPTH) {
+    pthread_cond_wait(&ring->changed, &ring->lock);
+  }
+
+  size_t slot = (ring->head + ring->count) % PIPELINE_DEPTH;
+  pthread_mutex_unlock(&ring->lock);
+
+  return ring->slots + slot * ring->slot_size;
+}
+
+/// Hands the slot from ring_acquire over to the consumer.
+static void ring_publish(struct Ring *ring) {
+  pthread_mutex_lock(&ring->lock);
+  ring->count++;
+  pthread_cond_signal(&ring->changed);
+  pthread_mutex_unlock(&ring->lock);
+}
+
+/// Tells the consumer that nothing else will be published.
+static void ring_close(struct Ring *ring) {
+  pthread_mutex_lock(&ring->lock);
+  ring->closed = 1;
+  pthread_cond_signal(&ring->changed);
+  pthread_mutex_unlock(&ring->lock);
+}
+
+/// Gets the oldest published slot, waiting while the ring is empty.
+/// @return The slot, valid until ring_release, or NULL once the ring is closed and empty.
+static void *ring_front(struct Ring *ring) {
+  pthread_mutex_lock(&ring->lock);
+
+  while (ring->count == 0 && !ring->closed) {
+    pthread_cond_wait(&ring->changed, &ring->lock);
+  }
+
+  void *slot = ring->count == 0 ? NULL : ring->slots + ring->head * ring->slot_size;
+  pthread_mutex_unlock(&ring->lock);
+
+  return slot;
+}
+
+/// Gives the slot from ring_front back to the producer.
+static void ring_release(struct Ring *ring) {
+  pthread_mutex_lock(&ring->lock);
+  ring->head = (ring->head + 1) % PIPELINE_DEPTH;
+  ring->count--;
+  pthread_cond_signal(&ring->changed);
+  pthread_mutex_unlock(&ring->lock);
+}
+
+/// Hands rendered output over to the write stage, or drops it if rendering failed.
+static void publish_output(struct Pipeline *pipeline, struct Writer *writer, int result, const char *failure) {
+  if (result == 0) {
+    ring_publish(&pipeline->output);
+  } else {
+    writer_destroy(writer);
+    fputs(failure, stderr);
+  }
+}
+
+/// Runs a command, handing its output, if any, to the write stage.
+static void execute_pipelined(struct Pipeline *pipeline, struct JobCommand *command) {
+  struct Writer *writer;
+  uint64_t span = trace_begin();
+
+  switch (command->cmd) {
+    case CMD_SHOW:
+      writer = (struct Writer *)ring_acquire(&pipeline->output);
+      writer_init(writer, 4096);
+      publish_output(pipeline, writer, ems_render_show(command->event_id, writer), "Failed to show event\n");
+      break;
+
+    case CMD_SEATS:
+      writer = (struct Writer *)ring_acquire(&pipeline->output);
+      writer_init(writer, 32);
+      publish_output(pipeline, writer, ems_render_free_seats(command->event_id, writer),
+                     "Failed to count free seats\n");
+      break;
+
+    case CMD_RESERVE_BEST:
+      writer = (struct Writer *)ring_acquire(&pipeline->output);
+      writer_init(writer, 16 * command->num_seats);
+      publish_output(pipeline, writer, ems_render_reserve_best(command->event_id, command->num_seats, writer),
+                     "Failed to reserve seats\n");
+      break;
+
+    case CMD_LIST_EVENTS:
+      writer = (struct Writer *)ring_acquire(&pipeline->output);
+      writer_init(writer, 4096);
+      publish_output(pipeline, writer, ems_render_list_events(writer), "Failed to list events\n");
+      break;
+
+    case CMD_WAIT:
+      // A single thread executes the file, so it is thread 1.
+      if (command->delay > 0 && command->wait_thread <= 1) {
+        printf("Waiting...\n");
+        ems_wait(command->delay);
+      }
+      break;
+
+    case CMD_CREATE:
+    case CMD_RESERVE:
+    case CMD_RESERVE_RANGE:
+    case CMD_RESERVE_BLOCK:
+    case CMD_HELP:
+    case CMD_BARRIER:
+    case CMD_EMPTY:
+    case CMD_INVALID:
+    case EOC:
+      // Traced by execute_command itself.
+      execute_command(command, pipeline->fdOut);
+      return;
+  }
+
+  trace_end(command_name(command->cmd), TRACE_COMMAND, span);
+}
+
+static void *execute_stage(void *arg) {
+  struct Pipeline *pipeline = (struct Pipeline *)arg;
+  struct JobCommand *command;
+
+  while ((command = (struct JobCommand *)ring_front(&pipeline->commands)) != NULL) {
+    execute_pipelined(pipeline, command);
+    ring_release(&pipeline->commands);
+  }
+
+  ring_close(&pipeline->output);
+  return NULL;
+}
+
+static void *write_stage(void *arg) {
+  struct Pipeline *pipeline = (struct Pipeline *)arg;
+  struct Writer *writer;
+
+  while ((writer = (struct Writer *)ring_front(&pipeline->output)) != NULL) {
+    if (writer_flush(writer, pipeline->fdOut) != 0) {
+      fprintf(stderr, "Failed to write output\n");
+    }
+
+    writer_destroy(writer);
+    ring_release(&pipeline->output);
+  }
+
+  return NULL;
+}
+
+/// Runs a job file on the calling thread alone, when the stages cannot be set up.
+static void run_sequential(int fd, int fdOut) {
+  struct JobCommand command;
+
+  while (read_command(fd, &command) != EOC) {
+    if (command.cmd == CMD_WAIT) {
+      if (command.delay > 0 && command.wait_thread <= 1) {
+        printf("Waiting...\n");
+        ems_wait(command.delay);
+      }
+    } else {
+      execute_command(&command, fdOut);
+    }
+  }
+}
+
+void pipeline_run_file(int fd, int fdOut) {
+  struct Pipeline pipeline = {.fdOut = fdOut};
+  pthread_t executor, writer;
+
+  if (ring_init(&pipeline.commands, sizeof(struct JobCommand)) != 0) {
+    fprintf(stderr, "Error allocating memory for pipeline\n");
+    run_sequential(fd, fdOut);
+    return;
+  }
+
+  if (ring_init(&pipeline.output, sizeof(struct Writer)) != 0) {
+    fprintf(stderr, "Error allocating memory for pipeline\n");
+    ring_destroy(&pipeline.commands);
+    run_sequential(fd, fdOut);
+    return;
+  }
+
+  if (pthread_create(&writer, NULL, write_stage, &pipeline) != 0) {
+    fprintf(stderr, "Failed to create pipeline thread\n");
+    ring_destroy(&pipeline.output);
+    ring_destroy(&pipeline.commands);
+    run_sequential(fd, fdOut);
+    return;
+  }
+
+  if (pthread_create(&executor, NULL, execute_stage, &pipeline) != 0) {
+    fprintf(stderr, "Failed to create pipeline thread\n");
+    ring_close(&pipeline.output);
+    pthread_join(writer, NULL);
+    ring_destroy(&pipeline.output);
+    ring_destroy(&pipeline.commands);
+    run_sequential(fd, fdOut);
+    return;
+  }
+
+  for (;;) {
+    struct JobCommand *command = (struct JobCommand *)ring_acquire(&pipeline.commands);
+    enum Command cmd = read_command(fd, command);
+
+    if (cmd == EOC) {
+      break;
+    }
+
+    // Commands run one at a time in file order, so a BARRIER has nothing to wait for.
+    if (cmd != CMD_EMPTY && cmd != CMD_BARRIER) {
+      ring_publish(&pipeline.commands);
+    }
+  }
+
+  ring_close(&pipeline.commands);
+  pthread_join(executor, NULL);
+  pthread_join(writer, NULL);
+
+  ring_destroy(&pipeline.output);
+  ring_destroy(&pipeline.commands);
+}
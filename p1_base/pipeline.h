@@ -0,0 +1,13 @@
+#ifndef EMS_PIPELINE_H
+#define EMS_PIPELINE_H
+
+/// Runs a job file through three stages connected by bounded rings: the calling thread parses
+/// commands, an execute thread runs them against the state and renders their output in memory,
+/// and a write thread writes that output to the file.
+/// @note Commands run and print in the order of the file, with up to PIPELINE_DEPTH of them
+/// parsed ahead of execution and as many outputs waiting to be written.
+/// @param fd File descriptor of the job file.
+/// @param fdOut File descriptor of the output file.
+void pipeline_run_file(int fd, int fdOut);
+
+#endif  // EMS_PIPELINE_H
@@ -0,0 +1,48 @@
+#include "protocol.h"
+
+#include <errno.h>
+#include <unistd.h>
+
+int protocol_read(int fd, void *buf, size_t count) {
+  char *dst = (char *)buf;
+  size_t done = 0;
+
+  while (done < count) {
+    ssize_t n = read(fd, dst + done, count - done);
+
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return 1;
+    }
+
+    if (n == 0) {
+      return 1;
+    }
+
+    done += (size_t)n;
+  }
+
+  return 0;
+}
+
+int protocol_write(int fd, const void *buf, size_t count) {
+  const char *src = (const char *)buf;
+  size_t done = 0;
+
+  while (done < count) {
+    ssize_t n = write(fd, src + done, count - done);
+
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return 1;
+    }
+
+    done += (size_t)n;
+  }
+
+  return 0;
+}
@@ -0,0 +1,36 @@
+#ifndef EMS_PROTOCOL_H
+#define EMS_PROTOCOL_H
+
+#include <stddef.h>
+
+/// Size of the pipe paths sent when registering a session, including the terminating null byte.
+/// @note A registration message must not exceed PIPE_BUF, so that messages from concurrent clients
+/// reach the server whole.
+#define PIPE_PATH_SIZE 256
+
+/// Operation codes, the first byte of every message sent to the server.
+/// Fields follow in the order given, as native unsigned int ids, size_t counts and int results.
+enum ProtocolOp {
+  OP_SETUP = 1,   /// On the registration pipe: request pipe path, response pipe path. Reply: session id.
+  OP_QUIT,        /// Ends the session. No reply.
+  OP_CREATE,      /// event_id, num_rows, num_cols. Reply: result.
+  OP_RESERVE,     /// event_id, num_seats, xs[num_seats], ys[num_seats]. Reply: result.
+  OP_SHOW,        /// event_id. Reply: result, then length and text as printed by SHOW if result is 0.
+  OP_LIST_EVENTS  /// Reply: result, then length and text as printed by LIST if result is 0.
+};
+
+/// Reads exactly count bytes from a pipe.
+/// @param fd File descriptor to read from.
+/// @param buf Buffer to read into.
+/// @param count Number of bytes to read.
+/// @return 0 if every byte was read, 1 if the pipe was closed or failed first.
+int protocol_read(int fd, void *buf, size_t count);
+
+/// Writes exactly count bytes to a pipe.
+/// @param fd File descriptor to write to.
+/// @param buf Bytes to write.
+/// @param count Number of bytes to write.
+/// @return 0 if every byte was written, 1 otherwise.
+int protocol_write(int fd, const void *buf, size_t count);
+
+#endif  // EMS_PROTOCOL_H
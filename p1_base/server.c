@@ -0,0 +1,330 @@
+#include "server.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "constants.h"
+#include "operations.h"
+#include "protocol.h"
+#include "writer.h"
+
+/// Pipes of a session waiting for a worker.
+struct SessionRequest {
+  char req_path[PIPE_PATH_SIZE];
+  char resp_path[PIPE_PATH_SIZE];
+};
+
+/// Bounded queue of sessions, filled by the main thread and drained by the workers.
+struct SessionQueue {
+  struct SessionRequest requests[SESSION_QUEUE_SIZE];
+  size_t head;
+  size_t count;
+  int closed;  // Set on shutdown; workers leave once the queue is empty
+  pthread_mutex_t lock;
+  pthread_cond_t not_empty;
+  pthread_cond_t not_full;
+};
+
+/// One of the threads serving sessions.
+struct SessionWorker {
+  pthread_t thread;
+  int session_id;
+};
+
+static struct SessionQueue queue = {
+    .lock = PTHREAD_MUTEX_INITIALIZER, .not_empty = PTHREAD_COND_INITIALIZER, .not_full = PTHREAD_COND_INITIALIZER};
+
+static volatile sig_atomic_t stopping = 0;
+static int register_fd = -1;
+static int stop_pipe[2] = {-1, -1};  // Write end closed on shutdown, waking every worker up
+
+/// Asks the main thread to shut down, waking it up with a byte on the registration pipe.
+static void handle_stop(int sig) {
+  (void)sig;
+  char op = OP_QUIT;
+
+  stopping = 1;
+  if (write(register_fd, &op, 1) < 0) {
+    // Nothing else can be done in a signal handler; the next registration wakes the server up.
+  }
+}
+
+/// Adds a session to the queue, waiting while it is full.
+static void queue_push(const struct SessionRequest *request) {
+  pthread_mutex_lock(&queue.lock);
+
+  while (queue.count == SESSION_QUEUE_SIZE) {
+    pthread_cond_wait(&queue.not_full, &queue.lock);
+  }
+
+  queue.requests[(queue.head + queue.count) % SESSION_QUEUE_SIZE] = *request;
+  queue.count++;
+
+  pthread_cond_signal(&queue.not_empty);
+  pthread_mutex_unlock(&queue.lock);
+}
+
+/// Takes the oldest session from the queue, waiting while it is empty.
+/// @return 0 if a session was taken, 1 if the queue was closed and is empty.
+static int queue_pop(struct SessionRequest *request) {
+  pthread_mutex_lock(&queue.lock);
+
+  while (queue.count == 0 && !queue.closed) {
+    pthread_cond_wait(&queue.not_empty, &queue.lock);
+  }
+
+  if (queue.count == 0) {
+    pthread_mutex_unlock(&queue.lock);
+    return 1;
+  }
+
+  *request = queue.requests[queue.head];
+  queue.head = (queue.head + 1) % SESSION_QUEUE_SIZE;
+  queue.count--;
+
+  pthread_cond_signal(&queue.not_full);
+  pthread_mutex_unlock(&queue.lock);
+  return 0;
+}
+
+/// Lets the workers leave once the sessions already queued are served.
+static void queue_close() {
+  pthread_mutex_lock(&queue.lock);
+  queue.closed = 1;
+  pthread_cond_broadcast(&queue.not_empty);
+  pthread_mutex_unlock(&queue.lock);
+}
+
+/// Sends the result of an operation that prints, followed by its output if it succeeded.
+static int send_rendered(int resp_fd, int result, struct Writer *writer) {
+  if (result == 0 && writer->error) {
+    result = 1;
+  }
+
+  if (protocol_write(resp_fd, &result, sizeof(result)) != 0) {
+    return 1;
+  }
+
+  if (result != 0) {
+    return 0;
+  }
+
+  size_t len = writer->len;
+  if (protocol_write(resp_fd, &len, sizeof(len)) != 0) {
+    return 1;
+  }
+
+  return writer_flush(writer, resp_fd);
+}
+
+/// Reads the fields of a request, executes it and sends the reply.
+/// @return 0 if the session can go on, 1 if the pipes broke or the request was malformed.
+static int serve_request(char op, int req_fd, int resp_fd) {
+  unsigned int event_id;
+  size_t num_rows, num_cols, num_seats;
+  size_t xs[MAX_RESERVATION_SIZE], ys[MAX_RESERVATION_SIZE];
+  struct Writer writer;
+  int result;
+
+  switch (op) {
+    case OP_CREATE:
+      if (protocol_read(req_fd, &event_id, sizeof(event_id)) != 0 ||
+          protocol_read(req_fd, &num_rows, sizeof(num_rows)) != 0 ||
+          protocol_read(req_fd, &num_cols, sizeof(num_cols)) != 0) {
+        return 1;
+      }
+
+      result = ems_create(event_id, num_rows, num_cols);
+      return protocol_write(resp_fd, &result, sizeof(result));
+
+    case OP_RESERVE:
+      if (protocol_read(req_fd, &event_id, sizeof(event_id)) != 0 ||
+          protocol_read(req_fd, &num_seats, sizeof(num_seats)) != 0 || num_seats > MAX_RESERVATION_SIZE ||
+          protocol_read(req_fd, xs, num_seats * sizeof(size_t)) != 0 ||
+          protocol_read(req_fd, ys, num_seats * sizeof(size_t)) != 0) {
+        return 1;
+      }
+
+      result = ems_reserve(event_id, num_seats, xs, ys);
+      return protocol_write(resp_fd, &result, sizeof(result));
+
+    case OP_SHOW:
+      if (protocol_read(req_fd, &event_id, sizeof(event_id)) != 0) {
+        return 1;
+      }
+
+      writer_init(&writer, 4096);
+      result = send_rendered(resp_fd, ems_render_show(event_id, &writer), &writer);
+      writer_destroy(&writer);
+      return result;
+
+    case OP_LIST_EVENTS:
+      writer_init(&writer, 4096);
+      result = send_rendered(resp_fd, ems_render_list_events(&writer), &writer);
+      writer_destroy(&writer);
+      return result;
+
+    default:
+      fprintf(stderr, "Invalid request\n");
+      return 1;
+  }
+}
+
+/// Waits for the next request of a session, or for the server to shut down.
+/// @return 0 if there is something to read on the request pipe, 1 if the session is to end.
+static int wait_for_request(int req_fd) {
+  struct pollfd fds[2] = {{.fd = req_fd, .events = POLLIN}, {.fd = stop_pipe[0], .events = POLLIN}};
+
+  while (poll(fds, 2, -1) < 0) {
+    if (errno != EINTR) {
+      perror("Failed to wait for requests");
+      return 1;
+    }
+  }
+
+  return fds[1].revents != 0;
+}
+
+/// Serves a session until its client quits or goes away, or the server shuts down.
+static void serve_session(int session_id, const struct SessionRequest *request) {
+  // Clients open the request pipe first, so the server must too or both would block.
+  int req_fd = open(request->req_path, O_RDONLY);
+
+  if (req_fd < 0) {
+    perror("Failed to open request pipe");
+    return;
+  }
+
+  int resp_fd = open(request->resp_path, O_WRONLY);
+
+  if (resp_fd < 0) {
+    perror("Failed to open response pipe");
+    close(req_fd);
+    return;
+  }
+
+  char op;
+  if (protocol_write(resp_fd, &session_id, sizeof(session_id)) == 0) {
+    while (wait_for_request(req_fd) == 0 && protocol_read(req_fd, &op, 1) == 0 && op != OP_QUIT) {
+      if (serve_request(op, req_fd, resp_fd) != 0) {
+        break;
+      }
+    }
+  }
+
+  close(resp_fd);
+  close(req_fd);
+}
+
+static void *session_worker(void *arg) {
+  struct SessionWorker *worker = (struct SessionWorker *)arg;
+  struct SessionRequest request;
+
+  while (queue_pop(&request) == 0) {
+    serve_session(worker->session_id, &request);
+  }
+
+  return NULL;
+}
+
+int ems_serve(const char *register_path, unsigned int max_sessions) {
+  if (unlink(register_path) != 0 && errno != ENOENT) {
+    perror("Failed to remove old registration pipe");
+    return 1;
+  }
+
+  if (mkfifo(register_path, 0640) != 0) {
+    perror("Failed to create registration pipe");
+    return 1;
+  }
+
+  // Opened for writing too, so that reads block between clients instead of hitting end of file,
+  // and so that the signal handler has a way to wake the main thread up.
+  register_fd = open(register_path, O_RDWR);
+
+  if (register_fd < 0) {
+    perror("Failed to open registration pipe");
+    unlink(register_path);
+    return 1;
+  }
+
+  if (pipe(stop_pipe) != 0) {
+    perror("Failed to create stop pipe");
+    close(register_fd);
+    unlink(register_path);
+    return 1;
+  }
+
+  struct sigaction action = {0};
+  action.sa_handler = handle_stop;
+  sigemptyset(&action.sa_mask);
+  action.sa_flags = SA_RESTART;
+  sigaction(SIGINT, &action, NULL);
+  sigaction(SIGTERM, &action, NULL);
+
+  // A client that goes away mid-reply must not take the server with it.
+  action.sa_handler = SIG_IGN;
+  sigaction(SIGPIPE, &action, NULL);
+
+  struct SessionWorker *workers = malloc(max_sessions * sizeof(struct SessionWorker));
+
+  if (workers == NULL) {
+    fprintf(stderr, "Error allocating memory for workers\n");
+    close(stop_pipe[0]);
+    close(stop_pipe[1]);
+    close(register_fd);
+    unlink(register_path);
+    return 1;
+  }
+
+  unsigned int started = 0;
+  for (; started < max_sessions; started++) {
+    workers[started].session_id = (int)started;
+
+    if (pthread_create(&workers[started].thread, NULL, session_worker, &workers[started]) != 0) {
+      fprintf(stderr, "Failed to create worker thread\n");
+      break;
+    }
+  }
+
+  int result = started == 0;
+  char op;
+  struct SessionRequest request;
+
+  while (started > 0 && !stopping && protocol_read(register_fd, &op, 1) == 0) {
+    if (op != OP_SETUP) {
+      continue;
+    }
+
+    if (protocol_read(register_fd, &request, sizeof(request)) != 0) {
+      result = 1;
+      break;
+    }
+
+    request.req_path[PIPE_PATH_SIZE - 1] = '\0';
+    request.resp_path[PIPE_PATH_SIZE - 1] = '\0';
+    queue_push(&request);
+  }
+
+  // Sessions waiting for their next request end at once, as do those still queued, so that idle
+  // clients cannot hold the shutdown up.
+  queue_close();
+  close(stop_pipe[1]);
+
+  for (unsigned int i = 0; i < started; i++) {
+    pthread_join(workers[i].thread, NULL);
+  }
+
+  free(workers);
+  close(stop_pipe[0]);
+  close(register_fd);
+  unlink(register_path);
+  return result;
+}
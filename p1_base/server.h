@@ -0,0 +1,13 @@
+#ifndef EMS_SERVER_H
+#define EMS_SERVER_H
+
+/// Serves client sessions registered on a named pipe until SIGINT or SIGTERM is received.
+/// @note The main thread only accepts registrations and queues them; each session is then served
+/// from start to end by one of max_sessions worker threads. On shutdown, the request being served
+/// in each session is answered and then every session ends, whether or not its client quit.
+/// @param register_path Path of the registration pipe, created by the server.
+/// @param max_sessions Number of sessions served at the same time.
+/// @return 0 if the server shut down cleanly, 1 otherwise.
+int ems_serve(const char *register_path, unsigned int max_sessions);
+
+#endif  // EMS_SERVER_H
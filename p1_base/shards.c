@@ -0,0 +1,288 @@
+#include "shards.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "command.h"
+#include "operations.h"
+
+/// Point where a file waits for every shard to catch up with it.
+struct Gather {
+  unsigned int pending;  // Shards that have not reached it yet
+  pthread_mutex_t lock;
+  pthread_cond_t done;
+};
+
+/// Message in the queue of a shard.
+struct ShardMessage {
+  struct ShardMessage *next;
+  struct Gather *gather;  // Set for gather points, which carry no command
+  int fdOut;
+  int stop;  // Set for the message that stops the shard
+  struct JobCommand command;
+};
+
+/// Multiple-producer single-consumer queue of messages, linked through the messages themselves.
+/// Producers swap themselves in as the tail without locking; only an idle shard takes the mutex,
+/// to sleep until a producer wakes it up.
+struct Shard {
+  struct ShardMessage *head;  // Owned by the shard; points to the last message taken
+  struct ShardMessage *tail;  // Swapped by producers
+  struct ShardMessage stub;   // Initial head
+  int sleeping;
+  pthread_mutex_t lock;
+  pthread_cond_t wake;
+  pthread_t thread;
+};
+
+static struct Shard *shards = NULL;
+static unsigned int num_shards = 0;
+
+/// Appends a message to the queue of a shard.
+static void shard_push(struct Shard *shard, struct ShardMessage *message) {
+  message->next = NULL;
+
+  struct ShardMessage *prev = __atomic_exchange_n(&shard->tail, message, __ATOMIC_SEQ_CST);
+  __atomic_store_n(&prev->next, message, __ATOMIC_SEQ_CST);
+
+  // Pairs with the store in shard_pop: either the shard sees the message or it is seen sleeping.
+  if (__atomic_load_n(&shard->sleeping, __ATOMIC_SEQ_CST)) {
+    pthread_mutex_lock(&shard->lock);
+    pthread_cond_signal(&shard->wake);
+    pthread_mutex_unlock(&shard->lock);
+  }
+}
+
+/// Takes the oldest message without waiting.
+/// @return The message, NULL if there is none yet.
+static struct ShardMessage *shard_try_pop(struct Shard *shard) {
+  struct ShardMessage *next = __atomic_load_n(&shard->head->next, __ATOMIC_SEQ_CST);
+
+  if (next == NULL) {
+    return NULL;
+  }
+
+  // The message becomes the new head, so it stays allocated until the next one replaces it.
+  struct ShardMessage *prev = shard->head;
+  shard->head = next;
+  if (prev != &shard->stub) {
+    free(prev);
+  }
+
+  return next;
+}
+
+/// Takes the oldest message, sleeping while the queue is empty.
+static struct ShardMessage *shard_pop(struct Shard *shard) {
+  struct ShardMessage *message = shard_try_pop(shard);
+
+  while (message == NULL) {
+    pthread_mutex_lock(&shard->lock);
+    __atomic_store_n(&shard->sleeping, 1, __ATOMIC_SEQ_CST);
+
+    message = shard_try_pop(shard);
+    if (message == NULL) {
+      pthread_cond_wait(&shard->wake, &shard->lock);
+      message = shard_try_pop(shard);
+    }
+
+    __atomic_store_n(&shard->sleeping, 0, __ATOMIC_SEQ_CST);
+    pthread_mutex_unlock(&shard->lock);
+  }
+
+  return message;
+}
+
+/// Marks a gather point as reached by one more shard.
+static void gather_arrive(struct Gather *gather) {
+  pthread_mutex_lock(&gather->lock);
+  if (--gather->pending == 0) {
+    pthread_cond_signal(&gather->done);
+  }
+  pthread_mutex_unlock(&gather->lock);
+}
+
+static void *shard_thread(void *arg) {
+  struct Shard *shard = (struct Shard *)arg;
+
+  for (;;) {
+    struct ShardMessage *message = shard_pop(shard);
+
+    if (message->stop) {
+      break;
+    }
+
+    if (message->gather != NULL) {
+      gather_arrive(message->gather);
+    } else if (message->command.cmd == CMD_WAIT) {
+      printf("Waiting...\n");
+      ems_wait(message->command.delay);
+    } else {
+      execute_command(&message->command, message->fdOut);
+    }
+  }
+
+  return NULL;
+}
+
+/// Sends a gather point to every shard and waits until all of them reach it.
+static void gather_all(struct Gather *gather) {
+  gather->pending = num_shards;
+
+  for (unsigned int i = 0; i < num_shards; i++) {
+    struct ShardMessage *message = malloc(sizeof(struct ShardMessage));
+
+    if (message == NULL) {
+      // Only wait for the shards that got it.
+      fprintf(stderr, "Error allocating memory for command\n");
+      pthread_mutex_lock(&gather->lock);
+      gather->pending -= num_shards - i;
+      pthread_mutex_unlock(&gather->lock);
+      break;
+    }
+
+    message->gather = gather;
+    message->stop = 0;
+    shard_push(&shards[i], message);
+  }
+
+  pthread_mutex_lock(&gather->lock);
+  while (gather->pending > 0) {
+    pthread_cond_wait(&gather->done, &gather->lock);
+  }
+  pthread_mutex_unlock(&gather->lock);
+}
+
+int shards_init(unsigned int count) {
+  shards = malloc(count * sizeof(struct Shard));
+
+  if (shards == NULL) {
+    fprintf(stderr, "Error allocating memory for shards\n");
+    return 1;
+  }
+
+  for (num_shards = 0; num_shards < count; num_shards++) {
+    struct Shard *shard = &shards[num_shards];
+
+    shard->stub.next = NULL;
+    shard->head = &shard->stub;
+    shard->tail = &shard->stub;
+    shard->sleeping = 0;
+    pthread_mutex_init(&shard->lock, NULL);
+    pthread_cond_init(&shard->wake, NULL);
+
+    if (pthread_create(&shard->thread, NULL, shard_thread, shard) != 0) {
+      fprintf(stderr, "Failed to create shard thread\n");
+      pthread_mutex_destroy(&shard->lock);
+      pthread_cond_destroy(&shard->wake);
+      shards_terminate();
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+void shards_terminate() {
+  for (unsigned int i = 0; i < num_shards; i++) {
+    struct ShardMessage *message = calloc(1, sizeof(struct ShardMessage));
+
+    // Without a message to stop it the shard cannot be joined; leave it running.
+    if (message == NULL) {
+      fprintf(stderr, "Error allocating memory for command\n");
+      continue;
+    }
+
+    message->stop = 1;
+    shard_push(&shards[i], message);
+    pthread_join(shards[i].thread, NULL);
+
+    if (shards[i].head != &shards[i].stub) {
+      free(shards[i].head);
+    }
+    pthread_mutex_destroy(&shards[i].lock);
+    pthread_cond_destroy(&shards[i].wake);
+  }
+
+  free(shards);
+  shards = NULL;
+  num_shards = 0;
+}
+
+void shards_run_file(int fd, int fdOut) {
+  struct Gather gather = {.lock = PTHREAD_MUTEX_INITIALIZER, .done = PTHREAD_COND_INITIALIZER};
+  struct ShardMessage *message = NULL;
+
+  for (;;) {
+    if (message == NULL) {
+      message = malloc(sizeof(struct ShardMessage));
+
+      if (message == NULL) {
+        fprintf(stderr, "Error allocating memory for command\n");
+        break;
+      }
+    }
+
+    switch (read_command(fd, &message->command)) {
+      case CMD_CREATE:
+      case CMD_RESERVE:
+      case CMD_RESERVE_BEST:
+      case CMD_RESERVE_RANGE:
+      case CMD_RESERVE_BLOCK:
+      case CMD_SHOW:
+      case CMD_SEATS:
+        message->gather = NULL;
+        message->fdOut = fdOut;
+        message->stop = 0;
+        shard_push(&shards[message->command.event_id % num_shards], message);
+        message = NULL;
+        break;
+
+      case CMD_LIST_EVENTS:
+        gather_all(&gather);
+        execute_command(&message->command, fdOut);
+        break;
+
+      case CMD_WAIT:
+        if (message->command.delay == 0) {
+          break;
+        }
+
+        // A WAIT for one thread delays the shard with that number; any other delays the file.
+        if (message->command.wait_thread == 0) {
+          printf("Waiting...\n");
+          ems_wait(message->command.delay);
+        } else if (message->command.wait_thread <= num_shards) {
+          message->gather = NULL;
+          message->stop = 0;
+          shard_push(&shards[message->command.wait_thread - 1], message);
+          message = NULL;
+        }
+        break;
+
+      case CMD_BARRIER:
+        gather_all(&gather);
+        break;
+
+      case CMD_HELP:
+        execute_command(&message->command, fdOut);
+        break;
+
+      case CMD_EMPTY:
+      case CMD_INVALID:
+        break;
+
+      case EOC:
+        gather_all(&gather);
+        free(message);
+        pthread_mutex_destroy(&gather.lock);
+        pthread_cond_destroy(&gather.done);
+        return;
+    }
+  }
+
+  gather_all(&gather);
+  pthread_mutex_destroy(&gather.lock);
+  pthread_cond_destroy(&gather.done);
+}
@@ -0,0 +1,23 @@
+#ifndef EMS_SHARDS_H
+#define EMS_SHARDS_H
+
+/// Starts the shard threads. Each shard runs every command on the events whose id maps to it, so
+/// an event is only ever touched by one thread.
+/// @note The same number of shards should be given to ems_set_shards before ems_init, so that each
+/// shard gets an event table of its own and runs its commands without locking.
+/// @param num_shards Number of shards.
+/// @return 0 if every shard was started, 1 otherwise.
+int shards_init(unsigned int num_shards);
+
+/// Stops the shard threads once their queues are drained.
+void shards_terminate();
+
+/// Reads a job file and routes its commands to the shards owning their events.
+/// @note Commands on different events may run and print in a different order than in the file.
+/// LIST, BARRIER and the end of the file wait until every shard has run the commands sent before
+/// them. Several files may be run at the same time.
+/// @param fd File descriptor of the job file.
+/// @param fdOut File descriptor of the output file.
+void shards_run_file(int fd, int fdOut);
+
+#endif  // EMS_SHARDS_H
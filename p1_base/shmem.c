@@ -0,0 +1,117 @@
+// Anonymous mappings are not part of POSIX.
+#define _DEFAULT_SOURCE
+
+#include "shmem.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+
+#define SHMEM_ALIGNMENT _Alignof(max_align_t)
+
+/// Start of the shared region, followed by the memory handed out so far.
+struct ShmemHeader {
+  pthread_mutex_t lock;  // Process-shared, serializes allocations from every process
+  size_t used;           // Bytes handed out so far, header included
+};
+
+static struct ShmemHeader *region = NULL;
+static size_t region_size = 0;
+
+static size_t align_up(size_t size) { return (size + SHMEM_ALIGNMENT - 1) & ~(SHMEM_ALIGNMENT - 1); }
+
+int shmem_init(size_t size) {
+  // Pages are only backed once they are touched, so the whole region can be reserved at once.
+  void *base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+
+  if (base == MAP_FAILED) {
+    perror("Failed to map shared state");
+    return 1;
+  }
+
+  region = (struct ShmemHeader *)base;
+  region_size = size;
+  region->used = align_up(sizeof(struct ShmemHeader));
+
+  pthread_mutexattr_t attr;
+  pthread_mutexattr_init(&attr);
+  pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+  pthread_mutex_init(&region->lock, &attr);
+  pthread_mutexattr_destroy(&attr);
+
+  return 0;
+}
+
+void shmem_terminate() {
+  if (region == NULL) {
+    return;
+  }
+
+  pthread_mutex_destroy(&region->lock);
+  munmap(region, region_size);
+  region = NULL;
+  region_size = 0;
+}
+
+int shmem_enabled() { return region != NULL; }
+
+void *shmem_calloc(size_t count, size_t size) {
+  if (region == NULL) {
+    return calloc(count, size);
+  }
+
+  if (size != 0 && count > SIZE_MAX / size) {
+    return NULL;
+  }
+
+  size_t bytes = count * size;
+  bytes = align_up(bytes ? bytes : 1);
+  void *ptr = NULL;
+
+  // Anonymous mappings start zeroed and nothing is ever reused, so the memory needs no clearing.
+  pthread_mutex_lock(&region->lock);
+  if (region_size - region->used >= bytes) {
+    ptr = (char *)region + region->used;
+    region->used += bytes;
+  }
+  pthread_mutex_unlock(&region->lock);
+
+  if (ptr == NULL) {
+    fprintf(stderr, "Shared state is full\n");
+  }
+
+  return ptr;
+}
+
+void shmem_free(void *ptr) {
+  if (region == NULL) {
+    free(ptr);
+  }
+}
+
+void shmem_mutex_init(pthread_mutex_t *mutex) {
+  if (region == NULL) {
+    pthread_mutex_init(mutex, NULL);
+    return;
+  }
+
+  pthread_mutexattr_t attr;
+  pthread_mutexattr_init(&attr);
+  pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+  pthread_mutex_init(mutex, &attr);
+  pthread_mutexattr_destroy(&attr);
+}
+
+void shmem_rwlock_init(pthread_rwlock_t *rwlock) {
+  if (region == NULL) {
+    pthread_rwlock_init(rwlock, NULL);
+    return;
+  }
+
+  pthread_rwlockattr_t attr;
+  pthread_rwlockattr_init(&attr);
+  pthread_rwlockattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+  pthread_rwlock_init(rwlock, &attr);
+  pthread_rwlockattr_destroy(&attr);
+}
@@ -0,0 +1,41 @@
+#ifndef EMS_SHMEM_H
+#define EMS_SHMEM_H
+
+#include <pthread.h>
+#include <stddef.h>
+
+/// Makes every later allocation of the event state come from a region shared with the processes
+/// forked afterwards, and every lock of the event state process-shared.
+/// @note The region is reserved up front, since memory mapped after a fork is not shared. Memory
+/// allocated from it is never given back until shmem_terminate.
+/// @param size Number of bytes to reserve.
+/// @return 0 if the region was mapped successfully, 1 otherwise.
+int shmem_init(size_t size);
+
+/// Unmaps the shared region, once nothing uses the event state anymore.
+void shmem_terminate();
+
+/// Checks whether the event state is shared between processes.
+/// @return 1 if shmem_init was called, 0 otherwise.
+int shmem_enabled();
+
+/// Allocates zeroed memory for the event state, from the shared region if there is one.
+/// @param count Number of elements.
+/// @param size Size of each element.
+/// @return Pointer to the memory, NULL on failure.
+void *shmem_calloc(size_t count, size_t size);
+
+/// Frees memory allocated with shmem_calloc. Memory of the shared region is kept until
+/// shmem_terminate.
+/// @param ptr Memory to free, may be NULL.
+void shmem_free(void *ptr);
+
+/// Initializes a mutex of the event state, process-shared if the state is.
+/// @param mutex Mutex to initialize.
+void shmem_mutex_init(pthread_mutex_t *mutex);
+
+/// Initializes a read-write lock of the event state, process-shared if the state is.
+/// @param rwlock Lock to initialize.
+void shmem_rwlock_init(pthread_rwlock_t *rwlock);
+
+#endif  // EMS_SHMEM_H
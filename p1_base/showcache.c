@@ -0,0 +1,172 @@
+#include "showcache.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "constants.h"
+
+/// Rendered SHOW output of one event. The cache holds one reference for as long as the entry is in
+/// it and every hit holds another while it copies the text, so an entry evicted meanwhile is only
+/// freed once the last copy is done.
+struct CachedShow {
+  struct Event *event;
+  unsigned int version;
+  unsigned int refs;        // References held, updated atomically
+  int referenced;           // Clock bit, set by every hit and cleared as the hand passes
+  size_t len;
+  struct CachedShow *prev;  // Inserted earlier, in the ring
+  struct CachedShow *next;  // Inserted later, in the ring
+  char text[];
+};
+
+/// Every entry, in a ring swept by a clock hand to pick the entries to evict. Hits never take the
+/// lock; it only guards the ring, the byte count and the changes to cached_show.
+static struct {
+  pthread_mutex_t lock;
+  struct CachedShow *hand;  // Next entry considered for eviction, NULL if the ring is empty
+  size_t used;
+  size_t budget;
+} cache = {.lock = PTHREAD_MUTEX_INITIALIZER, .budget = SHOW_CACHE_BYTES};
+
+/// Bytes an entry counts against the budget.
+static size_t entry_size(size_t len) { return sizeof(struct CachedShow) + len; }
+
+/// Drops a reference to an entry, freeing it with the last one.
+static void release_entry(struct CachedShow *entry) {
+  if (__atomic_sub_fetch(&entry->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+    free(entry);
+  }
+}
+
+/// Inserts an entry just behind the hand, so that it is the last one the hand reaches.
+static void insert_entry(struct CachedShow *entry) {
+  if (cache.hand == NULL) {
+    entry->prev = entry;
+    entry->next = entry;
+    cache.hand = entry;
+    return;
+  }
+
+  entry->next = cache.hand;
+  entry->prev = cache.hand->prev;
+  cache.hand->prev->next = entry;
+  cache.hand->prev = entry;
+}
+
+static void unlink_entry(struct CachedShow *entry) {
+  if (entry->next == entry) {
+    cache.hand = NULL;
+    return;
+  }
+
+  entry->prev->next = entry->next;
+  entry->next->prev = entry->prev;
+
+  if (cache.hand == entry) {
+    cache.hand = entry->next;
+  }
+}
+
+/// Drops an entry from the cache and from its event.
+static void remove_entry(struct CachedShow *entry) {
+  unlink_entry(entry);
+  cache.used -= entry_size(entry->len);
+
+  pthread_mutex_lock(&entry->event->show_lock);
+  if (entry->event->cached_show == entry) {
+    entry->event->cached_show = NULL;
+  }
+  pthread_mutex_unlock(&entry->event->show_lock);
+
+  release_entry(entry);
+}
+
+/// Evicts the first entry the hand finds without its clock bit, clearing the bits it passes.
+static void evict_entry() {
+  while (__atomic_exchange_n(&cache.hand->referenced, 0, __ATOMIC_RELAXED)) {
+    cache.hand = cache.hand->next;
+  }
+
+  remove_entry(cache.hand);
+}
+
+void show_cache_set_budget(size_t bytes) { cache.budget = bytes; }
+
+int show_cache_get(struct Event *event, unsigned int version, struct Writer *writer) {
+  if (cache.budget == 0) {
+    return 1;
+  }
+
+  // Only the event lock is taken, and just to pin the entry; the copy is made without it.
+  pthread_mutex_lock(&event->show_lock);
+
+  struct CachedShow *entry = event->cached_show;
+  if (entry == NULL || entry->version != version) {
+    pthread_mutex_unlock(&event->show_lock);
+    return 1;
+  }
+
+  __atomic_add_fetch(&entry->refs, 1, __ATOMIC_RELAXED);
+  pthread_mutex_unlock(&event->show_lock);
+
+  writer_put(writer, entry->text, entry->len);
+  __atomic_store_n(&entry->referenced, 1, __ATOMIC_RELAXED);
+  release_entry(entry);
+  return 0;
+}
+
+void show_cache_put(struct Event *event, unsigned int version, const char *text, size_t len) {
+  if (cache.budget == 0) {
+    return;
+  }
+
+  // Copied outside the lock; the entry is only published below.
+  struct CachedShow *entry = NULL;
+  if (entry_size(len) <= cache.budget) {
+    entry = malloc(entry_size(len));
+  }
+
+  if (entry != NULL) {
+    entry->event = event;
+    entry->version = version;
+    entry->refs = 1;
+    entry->referenced = 0;
+    entry->len = len;
+    memcpy(entry->text, text, len);
+  }
+
+  pthread_mutex_lock(&cache.lock);
+
+  // An event keeps one entry. If renderings raced, the one cached last wins; lookups check the
+  // version, so a stale one only costs a miss. cached_show only changes under the cache lock, so
+  // it can be read here without the event lock.
+  if (event->cached_show != NULL) {
+    remove_entry(event->cached_show);
+  }
+
+  if (entry != NULL) {
+    while (cache.used + entry_size(len) > cache.budget) {
+      evict_entry();
+    }
+
+    insert_entry(entry);
+    cache.used += entry_size(len);
+
+    pthread_mutex_lock(&event->show_lock);
+    event->cached_show = entry;
+    pthread_mutex_unlock(&event->show_lock);
+  }
+
+  pthread_mutex_unlock(&cache.lock);
+}
+
+void show_cache_clear() {
+  pthread_mutex_lock(&cache.lock);
+
+  while (cache.hand != NULL) {
+    remove_entry(cache.hand);
+  }
+
+  pthread_mutex_unlock(&cache.lock);
+}
@@ -0,0 +1,33 @@
+#ifndef EMS_SHOWCACHE_H
+#define EMS_SHOWCACHE_H
+
+#include <stddef.h>
+
+#include "eventlist.h"
+#include "writer.h"
+
+/// Sets how many bytes the cached SHOW output may take, 0 to disable caching.
+/// @note Should be called before any SHOW.
+/// @param bytes Memory budget, including the bookkeeping of each entry.
+void show_cache_set_budget(size_t bytes);
+
+/// Appends the cached SHOW output of an event to a writer, if it was rendered at the given version.
+/// @note Takes only the show lock of the event, never the lock of the whole cache.
+/// @param event Event to look up.
+/// @param version Current version of the event.
+/// @param writer Writer to append the output to.
+/// @return 0 if the output was cached, 1 otherwise.
+int show_cache_get(struct Event *event, unsigned int version, struct Writer *writer);
+
+/// Caches the SHOW output of an event, evicting entries that were not hit since the clock hand last
+/// passed them to stay within the budget.
+/// @param event Event the output belongs to.
+/// @param version Version of the event the output was rendered at.
+/// @param text Rendered output.
+/// @param len Length of the output.
+void show_cache_put(struct Event *event, unsigned int version, const char *text, size_t len);
+
+/// Frees every cached entry.
+void show_cache_clear();
+
+#endif  // EMS_SHOWCACHE_H
@@ -0,0 +1,402 @@
+#include "snapshot.h"
+
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "writer.h"
+
+_Static_assert(sizeof(size_t) == sizeof(uint64_t), "row counts are mapped from snapshots as size_t");
+_Static_assert(sizeof(unsigned int) == sizeof(uint32_t), "seats are mapped from snapshots as unsigned int");
+
+/// A snapshot is laid out as a header, which also records how much of the log the state covers, a table of the events in creation order, the positions of
+/// the events in the table sorted by id, and then the occupancy bitmap, free seats per row and
+/// seats of each event. Everything is referred to by its offset in the file and aligned to 8
+/// bytes, so the file can be used wherever it is mapped.
+#define SNAPSHOT_MAGIC "EMSSNAP2"
+#define SNAPSHOT_MAGIC_LEN 8
+
+struct SnapshotHeader {
+  char magic[SNAPSHOT_MAGIC_LEN];
+  uint64_t size;           // Size of the file
+  uint64_t num_events;
+  uint64_t events_offset;  // Table of struct SnapshotEvent
+  uint64_t by_id_offset;   // uint32_t positions in the table, sorted by event id
+  uint64_t log_length;     // Bytes of the log already reflected in the snapshot
+};
+
+struct SnapshotEvent {
+  uint32_t id;
+  uint32_t reservations;
+  uint64_t rows;
+  uint64_t cols;
+  uint64_t free_seats;
+  uint64_t occupied_offset;  // rows * ceil(cols / 64) uint64_t words
+  uint64_t row_free_offset;  // rows uint64_t counts
+  uint64_t data_offset;      // rows * cols uint32_t seats
+};
+
+/// A mapped snapshot.
+struct Snapshot {
+  char *base;
+  size_t size;
+  const struct SnapshotEvent *events;
+  const uint32_t *by_id;
+  size_t num_events;
+  uint64_t log_length;
+  struct Event **loaded;  // Events set up so far, by position in the table
+  pthread_mutex_t lock;   // Taken to set an event up
+};
+
+static size_t align8(size_t n) { return (n + 7) & ~(size_t)7; }
+
+/// Checks that a region lies within the mapping and is aligned.
+static int in_bounds(const struct Snapshot *snapshot, uint64_t offset, uint64_t len) {
+  return offset % 8 == 0 && offset <= snapshot->size && len <= snapshot->size - offset;
+}
+
+/// Sets up the event at a position of the table, checking its regions against the mapping.
+static struct Event *load_event(struct EventList *list, struct Snapshot *snapshot, size_t position) {
+  const struct SnapshotEvent *entry = &snapshot->events[position];
+  uint64_t num_seats, num_words;
+
+  if (__builtin_mul_overflow(entry->rows, entry->cols, &num_seats) ||
+      __builtin_mul_overflow(entry->rows, (entry->cols + 63) / 64, &num_words) || num_words > UINT64_MAX / 8 ||
+      num_seats > UINT64_MAX / 4 || entry->rows > UINT64_MAX / 8 ||
+      !in_bounds(snapshot, entry->occupied_offset, num_words * 8) ||
+      !in_bounds(snapshot, entry->row_free_offset, entry->rows * 8) ||
+      !in_bounds(snapshot, entry->data_offset, num_seats * 4) || entry->free_seats > num_seats) {
+    fprintf(stderr, "Corrupt snapshot entry for event %u\n", entry->id);
+    return NULL;
+  }
+
+  char *base = snapshot->base;
+  return map_event(list, entry->id, entry->rows, entry->cols, entry->reservations,
+                   (unsigned int *)(base + entry->data_offset), (uint64_t *)(base + entry->occupied_offset),
+                   (size_t *)(base + entry->row_free_offset), entry->free_seats);
+}
+
+struct Event *snapshot_get_event(struct EventList *list, unsigned int event_id) {
+  struct Snapshot *snapshot = list->snapshot;
+  size_t low = 0, high = snapshot->num_events;
+
+  // Positions are checked as they are used, so that mapping stays independent of the event count.
+  while (low < high) {
+    size_t mid = low + (high - low) / 2;
+    if (snapshot->by_id[mid] >= snapshot->num_events) {
+      fprintf(stderr, "Corrupt snapshot index\n");
+      return NULL;
+    }
+
+    if (snapshot->events[snapshot->by_id[mid]].id < event_id) {
+      low = mid + 1;
+    } else {
+      high = mid;
+    }
+  }
+
+  if (low == snapshot->num_events || snapshot->events[snapshot->by_id[low]].id != event_id) {
+    return NULL;
+  }
+
+  size_t position = snapshot->by_id[low];
+  struct Event *event = __atomic_load_n(&snapshot->loaded[position], __ATOMIC_ACQUIRE);
+
+  if (event == NULL) {
+    pthread_mutex_lock(&snapshot->lock);
+
+    event = snapshot->loaded[position];
+    if (event == NULL) {
+      event = load_event(list, snapshot, position);
+      __atomic_store_n(&snapshot->loaded[position], event, __ATOMIC_RELEASE);
+    }
+
+    pthread_mutex_unlock(&snapshot->lock);
+  }
+
+  return event;
+}
+
+/// Regions of one event to write, taken from a set up event or straight from the mapping.
+struct EventSource {
+  struct Event *event;                 // NULL if the event was never set up
+  const struct SnapshotEvent *mapped;  // Entry in the mapped snapshot, if event is NULL
+};
+
+/// Appends zeros up to the next multiple of 8 bytes.
+static void pad8(struct Writer *writer, size_t len) {
+  static const char zeros[8] = {0};
+  writer_put(writer, zeros, align8(len) - len);
+}
+
+/// Appends the bitmap, free seats per row and seats of an event.
+/// @return 0 if everything was buffered or written, 1 otherwise.
+static int put_event_regions(struct Writer *writer, const struct Snapshot *mapped, const struct EventSource *source,
+                              const struct SnapshotEvent *entry, int fd) {
+  size_t rows = (size_t)entry->rows, cols = (size_t)entry->cols;
+  size_t num_words = rows * ((cols + 63) / 64), num_seats = rows * cols;
+
+  if (source->event == NULL) {
+    writer_put(writer, mapped->base + source->mapped->occupied_offset, num_words * 8);
+    writer_put(writer, mapped->base + source->mapped->row_free_offset, rows * 8);
+    writer_put(writer, mapped->base + source->mapped->data_offset, num_seats * 4);
+    pad8(writer, num_seats * 4);
+    return writer->error;
+  }
+
+  struct Event *event = source->event;
+  writer_put(writer, (const char *)event->occupied, num_words * 8);
+  writer_put(writer, (const char *)event->row_free, rows * 8);
+
+  // Snapshots always hold 4 bytes per seat, so narrower and sparse seats are widened on the way.
+  if (event->data != NULL && event->data->width == 4) {
+    writer_put(writer, (const char *)event->data->seats, num_seats * 4);
+  } else {
+    for (size_t i = 0; i < num_seats; i++) {
+      unsigned int seat = seat_get(event, i);
+      writer_put(writer, (const char *)&seat, 4);
+
+      if (writer->len >= (1 << 20) && writer_flush(writer, fd) != 0) {
+        return 1;
+      }
+    }
+  }
+
+  pad8(writer, num_seats * 4);
+  return writer->error;
+}
+
+static int compare_keys(const void *a, const void *b) {
+  uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+  return (x > y) - (x < y);
+}
+
+int snapshot_write(struct EventList **lists, size_t num_lists, uint64_t log_length, const char *path) {
+  const struct Snapshot *mapped = lists[0]->snapshot;
+  size_t num_mapped = snapshot_num_events(mapped);
+  size_t num_events = num_mapped;
+
+  for (size_t i = 0; i < num_lists; i++) {
+    num_events += lists[i]->size;
+  }
+
+  struct EventSource *sources = calloc(num_events > 0 ? num_events : 1, sizeof(struct EventSource));
+  struct SnapshotEvent *table = calloc(num_events > 0 ? num_events : 1, sizeof(struct SnapshotEvent));
+  uint64_t *keys = malloc((num_events > 0 ? num_events : 1) * sizeof(uint64_t));
+  struct ListNode **cursors = malloc(num_lists * sizeof(struct ListNode *));
+
+  if (sources == NULL || table == NULL || keys == NULL || cursors == NULL) {
+    fprintf(stderr, "Error allocating memory for snapshot\n");
+    free(sources);
+    free(table);
+    free(keys);
+    free(cursors);
+    return 1;
+  }
+
+  // Events from an earlier snapshot come first, as they were created before any in the lists.
+  size_t n = 0;
+  for (; n < num_mapped; n++) {
+    sources[n].event = mapped->loaded[n];
+    sources[n].mapped = &mapped->events[n];
+  }
+
+  for (size_t i = 0; i < num_lists; i++) {
+    cursors[i] = lists[i]->head;
+  }
+  for (struct ListNode *node; (node = next_created(cursors, num_lists)) != NULL; n++) {
+    sources[n].event = node->event;
+  }
+  free(cursors);
+
+  size_t offset = align8(sizeof(struct SnapshotHeader));
+  struct SnapshotHeader header = {.num_events = num_events, .events_offset = offset, .log_length = log_length};
+  memcpy(header.magic, SNAPSHOT_MAGIC, SNAPSHOT_MAGIC_LEN);
+
+  offset += align8(num_events * sizeof(struct SnapshotEvent));
+  header.by_id_offset = offset;
+  offset += align8(num_events * sizeof(uint32_t));
+
+  for (size_t i = 0; i < num_events; i++) {
+    struct SnapshotEvent *entry = &table[i];
+    struct Event *event = sources[i].event;
+
+    if (event != NULL) {
+      entry->id = event->id;
+      entry->reservations = event->reservations;
+      entry->rows = event->rows;
+      entry->cols = event->cols;
+      entry->free_seats = event->free_seats;
+    } else {
+      *entry = *sources[i].mapped;
+    }
+
+    entry->occupied_offset = offset;
+    offset += entry->rows * ((entry->cols + 63) / 64) * 8;
+    entry->row_free_offset = offset;
+    offset += entry->rows * 8;
+    entry->data_offset = offset;
+    offset += align8(entry->rows * entry->cols * 4);
+
+    keys[i] = (uint64_t)entry->id << 32 | i;
+  }
+
+  header.size = offset;
+  qsort(keys, num_events, sizeof(uint64_t), compare_keys);
+
+  char tmp_path[PATH_MAX];
+  if (snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path) >= (int)sizeof(tmp_path)) {
+    fprintf(stderr, "Snapshot path too long\n");
+    free(sources);
+    free(table);
+    free(keys);
+    return 1;
+  }
+
+  int fd = open(tmp_path, O_CREAT | O_TRUNC | O_WRONLY, S_IRUSR | S_IWUSR);
+
+  if (fd < 0) {
+    perror("Failed to open snapshot");
+    free(sources);
+    free(table);
+    free(keys);
+    return 1;
+  }
+
+  struct Writer writer;
+  writer_init(&writer, 1 << 20);
+
+  writer_put(&writer, (const char *)&header, sizeof(header));
+  pad8(&writer, sizeof(header));
+  writer_put(&writer, (const char *)table, num_events * sizeof(struct SnapshotEvent));
+  pad8(&writer, num_events * sizeof(struct SnapshotEvent));
+
+  for (size_t i = 0; i < num_events; i++) {
+    uint32_t position = (uint32_t)keys[i];
+    writer_put(&writer, (const char *)&position, sizeof(position));
+  }
+  pad8(&writer, num_events * sizeof(uint32_t));
+
+  int result = 0;
+  for (size_t i = 0; i < num_events && result == 0; i++) {
+    if (put_event_regions(&writer, mapped, &sources[i], &table[i], fd) != 0 ||
+        (writer.len >= (1 << 20) && writer_flush(&writer, fd) != 0)) {
+      result = 1;
+    }
+  }
+
+  if (result == 0 && (writer_flush(&writer, fd) != 0 || fsync(fd) != 0)) {
+    result = 1;
+  }
+
+  writer_destroy(&writer);
+  close(fd);
+  free(sources);
+  free(table);
+  free(keys);
+
+  if (result != 0) {
+    fprintf(stderr, "Failed to write snapshot\n");
+    unlink(tmp_path);
+    return 1;
+  }
+
+  if (rename(tmp_path, path) != 0) {
+    perror("Failed to replace snapshot");
+    unlink(tmp_path);
+    return 1;
+  }
+
+  return 0;
+}
+
+size_t snapshot_num_events(const struct Snapshot *snapshot) { return snapshot ? snapshot->num_events : 0; }
+
+uint64_t snapshot_log_length(const struct Snapshot *snapshot) { return snapshot ? snapshot->log_length : 0; }
+
+unsigned int snapshot_event_id(const struct Snapshot *snapshot, size_t position) {
+  return snapshot->events[position].id;
+}
+
+int snapshot_map(struct EventList *list, const char *path) {
+  int fd = open(path, O_RDONLY);
+
+  if (fd < 0) {
+    perror("Failed to open snapshot");
+    return 1;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(struct SnapshotHeader)) {
+    fprintf(stderr, "Invalid snapshot\n");
+    close(fd);
+    return 1;
+  }
+
+  // Private and writable: the first write to a page gives the process its own copy of it.
+  size_t size = (size_t)st.st_size;
+  char *base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  close(fd);
+
+  if (base == MAP_FAILED) {
+    perror("Failed to map snapshot");
+    return 1;
+  }
+
+  struct Snapshot *snapshot = malloc(sizeof(struct Snapshot));
+  if (snapshot == NULL) {
+    fprintf(stderr, "Error allocating memory for snapshot\n");
+    munmap(base, size);
+    return 1;
+  }
+
+  const struct SnapshotHeader *header = (const struct SnapshotHeader *)base;
+  snapshot->base = base;
+  snapshot->size = size;
+  snapshot->num_events = (size_t)header->num_events;
+  snapshot->log_length = header->log_length;
+
+  if (memcmp(header->magic, SNAPSHOT_MAGIC, SNAPSHOT_MAGIC_LEN) != 0 || header->size != size ||
+      header->num_events > size / sizeof(struct SnapshotEvent) ||
+      !in_bounds(snapshot, header->events_offset, header->num_events * sizeof(struct SnapshotEvent)) ||
+      !in_bounds(snapshot, header->by_id_offset, header->num_events * sizeof(uint32_t))) {
+    fprintf(stderr, "Invalid snapshot\n");
+    free(snapshot);
+    munmap(base, size);
+    return 1;
+  }
+
+  snapshot->events = (const struct SnapshotEvent *)(base + header->events_offset);
+  snapshot->by_id = (const uint32_t *)(base + header->by_id_offset);
+
+  // Large enough to come straight from the kernel, so its pages are only zeroed once touched.
+  snapshot->loaded = calloc(snapshot->num_events > 0 ? snapshot->num_events : 1, sizeof(struct Event *));
+  if (snapshot->loaded == NULL) {
+    fprintf(stderr, "Error allocating memory for snapshot\n");
+    free(snapshot);
+    munmap(base, size);
+    return 1;
+  }
+
+  pthread_mutex_init(&snapshot->lock, NULL);
+  list->snapshot = snapshot;
+  return 0;
+}
+
+void snapshot_unmap(struct Snapshot *snapshot) {
+  if (snapshot == NULL) {
+    return;
+  }
+
+  munmap(snapshot->base, snapshot->size);
+  pthread_mutex_destroy(&snapshot->lock);
+  free(snapshot->loaded);
+  free(snapshot);
+}
@@ -0,0 +1,52 @@
+#ifndef EMS_SNAPSHOT_H
+#define EMS_SNAPSHOT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "eventlist.h"
+
+/// Writes every event of one or more lists, with its seats, to a snapshot file, in the order the
+/// events were created.
+/// @note The lists must not change while they are written. The file is written under a temporary
+/// name and renamed over path once it is on disk.
+/// @param lists Event lists to write, the first of which holds the snapshot they started from, if any.
+/// @param num_lists Number of lists.
+/// @param log_length Length of the log the events reflect, so that only the rest of it is replayed
+/// on top of the snapshot. 0 if there is no log.
+/// @param path Path of the snapshot.
+/// @return 0 if the snapshot was written successfully, 1 otherwise.
+int snapshot_write(struct EventList **lists, size_t num_lists, uint64_t log_length, const char *path);
+
+/// Maps a snapshot file into an empty list. Only the header is checked up front; each event is
+/// set up the first time it is looked up, with its seats served from the mapping and copied on
+/// write page by page.
+/// @param list Empty event list to attach the snapshot to.
+/// @param path Path of the snapshot.
+/// @return 0 if the snapshot was mapped successfully, 1 otherwise.
+int snapshot_map(struct EventList *list, const char *path);
+
+/// Unmaps a snapshot. Events set up from it must no longer be used.
+/// @param snapshot Snapshot to unmap, may be NULL.
+void snapshot_unmap(struct Snapshot *snapshot);
+
+/// Looks up an event of the snapshot attached to a list, setting it up on first use.
+/// @param list Event list the snapshot is attached to.
+/// @param event_id Event id.
+/// @return The event, NULL if it is not in the snapshot or could not be set up.
+struct Event *snapshot_get_event(struct EventList *list, unsigned int event_id);
+
+/// Gets the number of events in a snapshot.
+/// @param snapshot Snapshot, may be NULL.
+size_t snapshot_num_events(const struct Snapshot *snapshot);
+
+/// Gets the length of the log a snapshot reflects.
+/// @param snapshot Snapshot, may be NULL.
+uint64_t snapshot_log_length(const struct Snapshot *snapshot);
+
+/// Gets the id of an event of a snapshot, in the order the events were created.
+/// @param snapshot Snapshot.
+/// @param position Position of the event, below snapshot_num_events.
+unsigned int snapshot_event_id(const struct Snapshot *snapshot, size_t position);
+
+#endif  // EMS_SNAPSHOT_H
@@ -0,0 +1,302 @@
+#include "stats.h"
+
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "threadrec.h"
+
+/// Every power of two of nanoseconds is split into 2^SUB_BUCKET_BITS linear buckets, so recorded
+/// latencies keep about two significant digits whatever their magnitude.
+#define SUB_BUCKET_BITS 4
+#define SUB_BUCKETS (1 << SUB_BUCKET_BITS)
+#define NUM_BUCKETS ((64 - SUB_BUCKET_BITS + 1) * SUB_BUCKETS)
+
+/// Latencies of one operation, as recorded by one thread.
+struct Histogram {
+  uint64_t buckets[NUM_BUCKETS];
+  uint64_t count;
+  uint64_t total_ns;
+  uint64_t max_ns;
+};
+
+/// Statistics of one thread. Only the owning thread writes them; dumps read them concurrently,
+/// so every access is atomic.
+struct ThreadStats {
+  struct ThreadRecord record;
+  struct Histogram ops[STATS_NUM_OPS];
+  uint64_t counters[STATS_NUM_COUNTERS];
+};
+
+/// Time spent on one job file.
+struct FileStats {
+  char *path;
+  uint64_t elapsed_ns;
+  struct FileStats *next;
+};
+
+static const char *const op_names[STATS_NUM_OPS] = {"CREATE", "RESERVE", "SHOW", "LIST", "RES_BEST", "SEATS",
+                                                    "RES_BLK"};
+static const char *const counter_names[STATS_NUM_COUNTERS] = {"event accesses", "seat accesses",
+                                                               "reservations", "reservation conflicts",
+                                                               "show cache hits"};
+
+static int enabled = 0;
+static FILE *output = NULL;
+
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;  // Guards the list below and the output
+static struct FileStats *files = NULL;
+static struct FileStats **files_tail = &files;
+
+static struct ThreadRecords threads = THREAD_RECORDS_INITIALIZER(struct ThreadStats);
+static _Thread_local struct ThreadStats *local = NULL;
+
+static pthread_t signal_thread;
+static int stopping = 0;
+
+static uint64_t now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+/// Gets the statistics of the calling thread, claiming a record on first use.
+static struct ThreadStats *thread_stats() {
+  if (local == NULL) {
+    local = (struct ThreadStats *)thread_record_claim(&threads);
+  }
+
+  return local;
+}
+
+/// Adds to a value only ever written by the calling thread.
+static inline void add_relaxed(uint64_t *value, uint64_t amount) {
+  __atomic_store_n(value, __atomic_load_n(value, __ATOMIC_RELAXED) + amount, __ATOMIC_RELAXED);
+}
+
+static size_t bucket_of(uint64_t ns) {
+  if (ns < SUB_BUCKETS) {
+    return (size_t)ns;
+  }
+
+  unsigned int exponent = 63 - (unsigned int)__builtin_clzll(ns);
+  size_t sub = (size_t)(ns >> (exponent - SUB_BUCKET_BITS)) & (SUB_BUCKETS - 1);
+  return (exponent - SUB_BUCKET_BITS + 1) * SUB_BUCKETS + sub;
+}
+
+/// Gets the lowest latency that falls in a bucket.
+static uint64_t bucket_floor(size_t bucket) {
+  if (bucket < SUB_BUCKETS) {
+    return bucket;
+  }
+
+  unsigned int exponent = (unsigned int)(bucket / SUB_BUCKETS) + SUB_BUCKET_BITS - 1;
+  return (uint64_t)(SUB_BUCKETS + bucket % SUB_BUCKETS) << (exponent - SUB_BUCKET_BITS);
+}
+
+/// Finds the latency below which the given fraction of the operations fall.
+static uint64_t percentile(const struct Histogram *histogram, double fraction) {
+  uint64_t target = (uint64_t)((double)histogram->count * fraction);
+  uint64_t seen = 0;
+
+  for (size_t i = 0; i < NUM_BUCKETS; i++) {
+    seen += histogram->buckets[i];
+    if (seen > target) {
+      return bucket_floor(i);
+    }
+  }
+
+  return histogram->max_ns;
+}
+
+/// Handles SIGUSR1 for the whole process, dumping the statistics every time it arrives.
+static void *signal_handler_thread(void *arg) {
+  sigset_t *set = (sigset_t *)arg;
+  int sig;
+
+  while (sigwait(set, &sig) == 0 && !__atomic_load_n(&stopping, __ATOMIC_ACQUIRE)) {
+    stats_dump();
+  }
+
+  return NULL;
+}
+
+int stats_init(const char *path) {
+  static sigset_t set;
+
+  if (strcmp(path, "-") == 0) {
+    output = stderr;
+  } else {
+    output = fopen(path, "a");
+    if (output == NULL) {
+      perror("Failed to open stats file");
+      return 1;
+    }
+  }
+
+  sigemptyset(&set);
+  sigaddset(&set, SIGUSR1);
+  pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+  if (pthread_create(&signal_thread, NULL, signal_handler_thread, &set) != 0) {
+    fprintf(stderr, "Failed to create stats thread\n");
+    if (output != stderr) {
+      fclose(output);
+    }
+    return 1;
+  }
+
+  enabled = 1;
+  return 0;
+}
+
+void stats_terminate() {
+  if (!enabled) {
+    return;
+  }
+
+  __atomic_store_n(&stopping, 1, __ATOMIC_RELEASE);
+  pthread_kill(signal_thread, SIGUSR1);
+  pthread_join(signal_thread, NULL);
+
+  stats_dump();
+  enabled = 0;
+
+  thread_records_free(&threads);
+  local = NULL;
+
+  while (files != NULL) {
+    struct FileStats *next = files->next;
+    free(files->path);
+    free(files);
+    files = next;
+  }
+  files_tail = &files;
+
+  if (output != stderr) {
+    fclose(output);
+  }
+}
+
+uint64_t stats_start() { return enabled ? now_ns() : 0; }
+
+void stats_record(enum StatsOp op, uint64_t start) {
+  if (!enabled) {
+    return;
+  }
+
+  struct ThreadStats *stats = thread_stats();
+  if (stats == NULL) {
+    return;
+  }
+
+  uint64_t ns = now_ns() - start;
+  struct Histogram *histogram = &stats->ops[op];
+
+  add_relaxed(&histogram->buckets[bucket_of(ns)], 1);
+  add_relaxed(&histogram->count, 1);
+  add_relaxed(&histogram->total_ns, ns);
+  if (ns > histogram->max_ns) {
+    __atomic_store_n(&histogram->max_ns, ns, __ATOMIC_RELAXED);
+  }
+}
+
+void stats_count(enum StatsCounter counter) {
+  if (!enabled) {
+    return;
+  }
+
+  struct ThreadStats *stats = thread_stats();
+  if (stats != NULL) {
+    add_relaxed(&stats->counters[counter], 1);
+  }
+}
+
+void stats_record_file(const char *path, uint64_t start) {
+  if (!enabled) {
+    return;
+  }
+
+  struct FileStats *file = malloc(sizeof(struct FileStats));
+  if (file == NULL) {
+    return;
+  }
+
+  file->elapsed_ns = now_ns() - start;
+  file->path = strdup(path);
+  file->next = NULL;
+
+  if (file->path == NULL) {
+    free(file);
+    return;
+  }
+
+  pthread_mutex_lock(&stats_lock);
+  *files_tail = file;
+  files_tail = &file->next;
+  pthread_mutex_unlock(&stats_lock);
+}
+
+void stats_dump() {
+  if (output == NULL) {
+    return;
+  }
+
+  struct Histogram *total = calloc(STATS_NUM_OPS, sizeof(struct Histogram));
+  uint64_t counters[STATS_NUM_COUNTERS] = {0};
+
+  if (total == NULL) {
+    return;
+  }
+
+  pthread_mutex_lock(&stats_lock);
+
+  for (struct ThreadRecord *record = thread_records_first(&threads); record != NULL; record = record->next) {
+    struct ThreadStats *stats = (struct ThreadStats *)record;
+    for (size_t op = 0; op < STATS_NUM_OPS; op++) {
+      struct Histogram *histogram = &stats->ops[op];
+
+      for (size_t i = 0; i < NUM_BUCKETS; i++) {
+        total[op].buckets[i] += __atomic_load_n(&histogram->buckets[i], __ATOMIC_RELAXED);
+      }
+      total[op].count += __atomic_load_n(&histogram->count, __ATOMIC_RELAXED);
+      total[op].total_ns += __atomic_load_n(&histogram->total_ns, __ATOMIC_RELAXED);
+
+      uint64_t max_ns = __atomic_load_n(&histogram->max_ns, __ATOMIC_RELAXED);
+      if (max_ns > total[op].max_ns) {
+        total[op].max_ns = max_ns;
+      }
+    }
+
+    for (size_t i = 0; i < STATS_NUM_COUNTERS; i++) {
+      counters[i] += __atomic_load_n(&stats->counters[i], __ATOMIC_RELAXED);
+    }
+  }
+
+  fprintf(output, "--- ems stats ---\n");
+  fprintf(output, "%-8s %10s %12s %12s %12s %12s\n", "op", "count", "mean_us", "p50_us", "p99_us", "max_us");
+  for (size_t op = 0; op < STATS_NUM_OPS; op++) {
+    struct Histogram *histogram = &total[op];
+    double mean = histogram->count ? (double)histogram->total_ns / (double)histogram->count : 0.0;
+
+    fprintf(output, "%-8s %10llu %12.1f %12.1f %12.1f %12.1f\n", op_names[op], (unsigned long long)histogram->count,
+            mean / 1000.0, (double)percentile(histogram, 0.50) / 1000.0, (double)percentile(histogram, 0.99) / 1000.0,
+            (double)histogram->max_ns / 1000.0);
+  }
+
+  for (size_t i = 0; i < STATS_NUM_COUNTERS; i++) {
+    fprintf(output, "%s: %llu\n", counter_names[i], (unsigned long long)counters[i]);
+  }
+
+  for (struct FileStats *file = files; file != NULL; file = file->next) {
+    fprintf(output, "file %s: %.3f ms\n", file->path, (double)file->elapsed_ns / 1000000.0);
+  }
+
+  fflush(output);
+  pthread_mutex_unlock(&stats_lock);
+
+  free(total);
+}
@@ -0,0 +1,59 @@
+#ifndef EMS_STATS_H
+#define EMS_STATS_H
+
+#include <stdint.h>
+
+/// Operations whose latency is recorded.
+enum StatsOp {
+  STATS_CREATE,
+  STATS_RESERVE,
+  STATS_SHOW,
+  STATS_LIST_EVENTS,
+  STATS_RESERVE_BEST,
+  STATS_FREE_SEATS,
+  STATS_RESERVE_BLOCK,
+  STATS_NUM_OPS
+};
+
+/// Events that are counted.
+enum StatsCounter {
+  STATS_EVENT_ACCESSES,     // Calls to get_event_with_delay
+  STATS_SEAT_ACCESSES,      // Calls to get_seat_with_delay
+  STATS_RESERVE_SUCCESSES,  // Reservations that claimed every seat
+  STATS_RESERVE_CONFLICTS,  // Reservations that failed on an already reserved seat
+  STATS_SHOW_CACHE_HITS,    // SHOWs served from the show cache
+  STATS_NUM_COUNTERS
+};
+
+/// Starts collecting statistics and dumps them whenever the process receives SIGUSR1.
+/// @note Must be called before any other thread is created, so that they all leave SIGUSR1 to
+/// the thread that handles it.
+/// @param path File to append the summaries to, "-" for stderr.
+/// @return 0 if statistics are being collected, 1 otherwise.
+int stats_init(const char *path);
+
+/// Dumps a last summary and stops collecting statistics.
+void stats_terminate();
+
+/// Gets the time to pass to stats_record once an operation finishes.
+/// @return Current monotonic time in nanoseconds, 0 if statistics are not being collected.
+uint64_t stats_start();
+
+/// Records the latency of an operation in the histogram of the calling thread.
+/// @param op Operation that finished.
+/// @param start Value returned by stats_start when the operation began.
+void stats_record(enum StatsOp op, uint64_t start);
+
+/// Increments a counter of the calling thread.
+/// @param counter Counter to increment.
+void stats_count(enum StatsCounter counter);
+
+/// Records the time spent executing a job file.
+/// @param path Path of the job file.
+/// @param start Value returned by stats_start when the file was started.
+void stats_record_file(const char *path, uint64_t start);
+
+/// Writes a summary of the statistics collected so far.
+void stats_dump();
+
+#endif  // EMS_STATS_H
@@ -0,0 +1,65 @@
+#include "threadrec.h"
+
+#include <stdlib.h>
+
+/// Gives the record of an exiting thread back.
+static void release_record(void *arg) {
+  struct ThreadRecord *record = (struct ThreadRecord *)arg;
+  __atomic_store_n(&record->in_use, 0, __ATOMIC_RELEASE);
+}
+
+struct ThreadRecord *thread_record_claim(struct ThreadRecords *records) {
+  pthread_mutex_lock(&records->lock);
+
+  if (!records->has_key) {
+    if (pthread_key_create(&records->key, release_record) != 0) {
+      pthread_mutex_unlock(&records->lock);
+      return NULL;
+    }
+    records->has_key = 1;
+  }
+
+  struct ThreadRecord *record = records->head;
+  while (record != NULL && __atomic_load_n(&record->in_use, __ATOMIC_ACQUIRE)) {
+    record = record->next;
+  }
+
+  if (record == NULL) {
+    record = calloc(1, records->size);
+    if (record == NULL) {
+      pthread_mutex_unlock(&records->lock);
+      return NULL;
+    }
+
+    record->id = ++records->count;
+    record->next = records->head;
+    __atomic_store_n(&records->head, record, __ATOMIC_RELEASE);
+  }
+
+  __atomic_store_n(&record->in_use, 1, __ATOMIC_RELAXED);
+  pthread_mutex_unlock(&records->lock);
+
+  pthread_setspecific(records->key, record);
+  return record;
+}
+
+struct ThreadRecord *thread_records_first(struct ThreadRecords *records) {
+  return __atomic_load_n(&records->head, __ATOMIC_ACQUIRE);
+}
+
+void thread_records_free(struct ThreadRecords *records) {
+  pthread_mutex_lock(&records->lock);
+
+  while (records->head != NULL) {
+    struct ThreadRecord *next = records->head->next;
+    free(records->head);
+    records->head = next;
+  }
+  records->count = 0;
+
+  if (records->has_key) {
+    pthread_setspecific(records->key, NULL);
+  }
+
+  pthread_mutex_unlock(&records->lock);
+}
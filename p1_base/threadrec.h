@@ -0,0 +1,46 @@
+#ifndef EMS_THREADREC_H
+#define EMS_THREADREC_H
+
+#include <pthread.h>
+#include <stddef.h>
+
+/// Header of a record owned by one thread at a time. Records of a kind embed it as their first
+/// member; the record of a thread that exits is taken over, with what it holds, by the next thread
+/// that needs one, so there are only ever as many records as threads alive at once.
+struct ThreadRecord {
+  int in_use;                /// Owned by a live thread.
+  unsigned int id;           /// Number of the record, from 1 in the order records were created.
+  struct ThreadRecord *next; /// Record created before this one.
+};
+
+/// Every record of one kind.
+struct ThreadRecords {
+  size_t size;               /// Size of a record, header included.
+  struct ThreadRecord *head; /// Last record created. Only ever pushed to, so traversed without the lock.
+  unsigned int count;        /// Number of records created.
+  int has_key;               /// Set once key was created.
+  pthread_key_t key;         /// Gives the record of an exiting thread back.
+  pthread_mutex_t lock;      /// Serializes the claiming of records.
+};
+
+#define THREAD_RECORDS_INITIALIZER(type) {.size = sizeof(type), .lock = PTHREAD_MUTEX_INITIALIZER}
+
+/// Claims a record for the calling thread, reusing one given back by an exited thread or creating
+/// a zeroed one.
+/// @note Callers keep the record in a thread-local variable rather than calling this again.
+/// @param records Records to claim from.
+/// @return The record, NULL if memory ran out.
+struct ThreadRecord *thread_record_claim(struct ThreadRecords *records);
+
+/// Gets the last record created, from which every other one can be reached through next.
+/// @note Safe to call while records are being claimed.
+/// @param records Records to traverse.
+/// @return The record, NULL if there is none.
+struct ThreadRecord *thread_records_first(struct ThreadRecords *records);
+
+/// Frees every record. The record the calling thread claimed is forgotten along with the others.
+/// @note Should only be called once no other thread uses a record.
+/// @param records Records to free.
+void thread_records_free(struct ThreadRecords *records);
+
+#endif  // EMS_THREADREC_H
@@ -0,0 +1,138 @@
+#include "trace.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "constants.h"
+#include "threadrec.h"
+
+/// One finished span.
+struct TraceSpan {
+  const char *name;
+  enum TraceCategory category;
+  uint64_t start_ns;
+  uint64_t duration_ns;
+};
+
+/// Spans of one thread. Records are never freed while tracing, so each record, numbered by its
+/// header, is one track of the timeline.
+struct TraceRing {
+  struct ThreadRecord record;
+  struct TraceSpan spans[TRACE_RING_SPANS];
+  uint64_t recorded;  // Spans recorded so far, of which the last TRACE_RING_SPANS are kept
+};
+
+static const char *const category_names[TRACE_NUM_CATEGORIES] = {"command", "parse", "ems", "wait"};
+
+static int enabled = 0;
+static FILE *output = NULL;
+static uint64_t origin_ns = 0;  // Time trace_init was called, which the trace starts from
+
+static struct ThreadRecords rings = THREAD_RECORDS_INITIALIZER(struct TraceRing);
+static _Thread_local struct TraceRing *local = NULL;
+
+static uint64_t now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+/// Gets the record of the calling thread, claiming one on first use.
+/// @return The record, NULL if memory ran out.
+static struct TraceRing *thread_ring() {
+  if (local == NULL) {
+    local = (struct TraceRing *)thread_record_claim(&rings);
+  }
+
+  return local;
+}
+
+int trace_init(const char *path) {
+  output = fopen(path, "w");
+  if (output == NULL) {
+    perror("Failed to open trace file");
+    return 1;
+  }
+
+  origin_ns = now_ns();
+  enabled = 1;
+  return 0;
+}
+
+/// Writes the spans of one record, oldest first.
+/// @param first Set while no span was written yet, so that no separator is needed.
+static void write_ring(const struct TraceRing *ring, int pid, int *first) {
+  uint64_t kept = ring->recorded < TRACE_RING_SPANS ? ring->recorded : TRACE_RING_SPANS;
+
+  for (uint64_t i = ring->recorded - kept; i < ring->recorded; i++) {
+    const struct TraceSpan *span = &ring->spans[i % TRACE_RING_SPANS];
+    uint64_t start_ns = span->start_ns - origin_ns;
+
+    // Chrome expects microseconds, so nanoseconds become their fractional part.
+    fprintf(output,
+            "%s\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%llu.%03u,\"dur\":%llu.%03u,"
+            "\"pid\":%d,\"tid\":%u}",
+            *first ? "" : ",", span->name, category_names[span->category], (unsigned long long)(start_ns / 1000),
+            (unsigned int)(start_ns % 1000), (unsigned long long)(span->duration_ns / 1000),
+            (unsigned int)(span->duration_ns % 1000), pid, ring->record.id);
+    *first = 0;
+  }
+}
+
+void trace_terminate() {
+  if (!enabled) {
+    return;
+  }
+
+  enabled = 0;
+
+  int pid = (int)getpid();
+  int first = 1;
+  uint64_t dropped = 0;
+
+  fprintf(output, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+  for (struct ThreadRecord *record = thread_records_first(&rings); record != NULL; record = record->next) {
+    struct TraceRing *ring = (struct TraceRing *)record;
+    write_ring(ring, pid, &first);
+
+    if (ring->recorded > TRACE_RING_SPANS) {
+      dropped += ring->recorded - TRACE_RING_SPANS;
+    }
+  }
+  fprintf(output, "\n]}\n");
+
+  if (fclose(output) != 0) {
+    perror("Failed to write trace file");
+  }
+  output = NULL;
+
+  if (dropped > 0) {
+    fprintf(stderr, "Trace dropped the %llu oldest spans\n", (unsigned long long)dropped);
+  }
+
+  thread_records_free(&rings);
+  local = NULL;
+}
+
+uint64_t trace_begin() { return enabled ? now_ns() : 0; }
+
+void trace_end(const char *name, enum TraceCategory category, uint64_t start) {
+  if (start == 0) {
+    return;
+  }
+
+  struct TraceRing *ring = thread_ring();
+  if (ring == NULL) {
+    return;
+  }
+
+  struct TraceSpan *span = &ring->spans[ring->recorded % TRACE_RING_SPANS];
+  span->name = name;
+  span->category = category;
+  span->start_ns = start;
+  span->duration_ns = now_ns() - start;
+  ring->recorded++;
+}
@@ -0,0 +1,39 @@
+#ifndef EMS_TRACE_H
+#define EMS_TRACE_H
+
+#include <stdint.h>
+
+/// Timeline of what every thread was doing, kept in a ring buffer per thread and written out as a
+/// Chrome trace_event JSON file, which chrome://tracing and Perfetto open.
+
+/// Kinds of spans.
+enum TraceCategory {
+  TRACE_COMMAND,  // A command of a job file, from its arguments being parsed to its end
+  TRACE_PARSE,    // A command read by one thread to be executed by another
+  TRACE_EMS,      // A call to one of the ems_* operations
+  TRACE_WAIT,     // Time spent waiting on a lock or the simulated access delay
+  TRACE_NUM_CATEGORIES
+};
+
+/// Starts recording spans, to be written to a file by trace_terminate.
+/// @note Must be called before any thread that records spans is created.
+/// @param path File to write the trace to.
+/// @return 0 if spans are being recorded, 1 otherwise.
+int trace_init(const char *path);
+
+/// Writes every span recorded to the trace file and stops recording.
+/// @note Must be called once every thread that recorded spans has finished.
+void trace_terminate();
+
+/// Gets the time to pass to trace_end once a span finishes.
+/// @return Current monotonic time in nanoseconds, 0 if spans are not being recorded.
+uint64_t trace_begin();
+
+/// Records a span in the ring buffer of the calling thread. Once the buffer is full, the oldest
+/// spans are overwritten.
+/// @param name Name of the span, which must outlive the trace, such as a string literal.
+/// @param category Kind of span.
+/// @param start Value returned by trace_begin when the span began.
+void trace_end(const char *name, enum TraceCategory category, uint64_t start);
+
+#endif  // EMS_TRACE_H
@@ -0,0 +1,369 @@
+#include "wal.h"
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "constants.h"
+#include "writer.h"
+
+/// Every record is its type (1 byte), the length of its payload (4 bytes), the payload and an
+/// FNV-1a checksum of all of the above (4 bytes), in host byte order. Payloads are:
+///   CREATE   event id (4), rows (8), columns (8)
+///   RESERVE  event id (4), reservation id (4), number of seats (4), seat indices (8 each)
+///   BLOCK    event id (4), reservation id (4), first row (8), first column (8), rows (8), columns (8)
+enum WalRecord { WAL_CREATE = 1, WAL_RESERVE = 2, WAL_RESERVE_BLOCK = 3 };
+
+#define WAL_HEADER_SIZE 5
+#define WAL_CHECKSUM_SIZE 4
+#define WAL_CREATE_SIZE 20
+#define WAL_RESERVE_SIZE(num_seats) (12 + 8 * (num_seats))
+#define WAL_RESERVE_BLOCK_SIZE 40
+
+/// The log. Committers append records to pending under the lock; the first one to sync becomes
+/// the leader of a batch, swaps pending out and writes it while the others wait for it.
+static struct {
+  int fd;
+  unsigned int window_us;
+  struct Writer pending;   // Records appended since the last batch was taken
+  struct Writer flushing;  // Batch being written by the leader
+  uint64_t appended;       // Sequence number of the last record appended
+  uint64_t durable;        // Sequence number of the last record on disk
+  uint64_t length;         // Bytes of the log on disk
+  int leader;              // Set while a batch is being written
+  int failed;              // Set once a batch could not be written; nothing is durable after it
+  pthread_mutex_t lock;
+  pthread_cond_t synced;
+} wal = {.fd = -1, .lock = PTHREAD_MUTEX_INITIALIZER, .synced = PTHREAD_COND_INITIALIZER};
+
+static uint32_t checksum(const char *data, size_t len) {
+  uint32_t hash = 2166136261u;
+
+  for (size_t i = 0; i < len; i++) {
+    hash = (hash ^ (uint8_t)data[i]) * 16777619u;
+  }
+
+  return hash;
+}
+
+/// Appends a record to pending.
+/// @note Called with the lock held.
+/// @return Sequence number of the record.
+static uint64_t append_record(enum WalRecord type, const char *payload, uint32_t len) {
+  char header[WAL_HEADER_SIZE];
+  header[0] = (char)type;
+  memcpy(header + 1, &len, sizeof(len));
+
+  size_t start = wal.pending.len;
+  writer_put(&wal.pending, header, WAL_HEADER_SIZE);
+  writer_put(&wal.pending, payload, len);
+
+  uint32_t sum = wal.pending.error ? 0 : checksum(wal.pending.data + start, WAL_HEADER_SIZE + len);
+  writer_put(&wal.pending, (const char *)&sum, WAL_CHECKSUM_SIZE);
+
+  return ++wal.appended;
+}
+
+/// Applies one record.
+/// @return 0 if it was applied, 1 if it is malformed or could not be applied.
+static int replay_record(char type, const char *payload, uint32_t len, const struct WalHandlers *handlers) {
+  uint32_t event_id, reservation_id, num_seats;
+  uint64_t rows, cols, seat, first_row, first_col;
+  size_t seats[MAX_RESERVATION_SIZE];
+
+  switch (type) {
+    case WAL_CREATE:
+      if (len != WAL_CREATE_SIZE) return 1;
+      memcpy(&event_id, payload, 4);
+      memcpy(&rows, payload + 4, 8);
+      memcpy(&cols, payload + 12, 8);
+      return handlers->create(event_id, (size_t)rows, (size_t)cols);
+
+    case WAL_RESERVE:
+      if (len < WAL_RESERVE_SIZE(0)) return 1;
+      memcpy(&event_id, payload, 4);
+      memcpy(&reservation_id, payload + 4, 4);
+      memcpy(&num_seats, payload + 8, 4);
+      if (num_seats == 0 || num_seats > MAX_RESERVATION_SIZE || len != WAL_RESERVE_SIZE(num_seats)) return 1;
+
+      for (uint32_t i = 0; i < num_seats; i++) {
+        memcpy(&seat, payload + WAL_RESERVE_SIZE(i), 8);
+        seats[i] = (size_t)seat;
+      }
+      return handlers->reserve(event_id, reservation_id, seats, num_seats);
+
+    case WAL_RESERVE_BLOCK:
+      if (len != WAL_RESERVE_BLOCK_SIZE) return 1;
+      memcpy(&event_id, payload, 4);
+      memcpy(&reservation_id, payload + 4, 4);
+      memcpy(&first_row, payload + 8, 8);
+      memcpy(&first_col, payload + 16, 8);
+      memcpy(&rows, payload + 24, 8);
+      memcpy(&cols, payload + 32, 8);
+      return handlers->reserve_block(event_id, reservation_id, (size_t)first_row, (size_t)first_col, (size_t)rows,
+                                     (size_t)cols);
+
+    default:
+      return 1;
+  }
+}
+
+/// Replays the log from a record on.
+/// @param start Offset of the first record to replay.
+/// @param good Set to the length of the log up to the last record that checked out.
+/// @return 0 if every intact record was applied, 1 otherwise.
+static int replay(uint64_t start, const struct WalHandlers *handlers, off_t *good) {
+  struct stat st;
+  *good = 0;
+
+  if (fstat(wal.fd, &st) != 0) {
+    perror("Failed to read log");
+    return 1;
+  }
+
+  if ((uint64_t)st.st_size < start) {
+    fprintf(stderr, "Log is shorter than the snapshot expects\n");
+    return 1;
+  }
+
+  if (lseek(wal.fd, (off_t)start, SEEK_SET) < 0) {
+    perror("Failed to read log");
+    return 1;
+  }
+
+  size_t size = (size_t)((uint64_t)st.st_size - start);
+  char *log = malloc(size > 0 ? size : 1);
+
+  if (log == NULL) {
+    fprintf(stderr, "Error allocating memory for log\n");
+    return 1;
+  }
+
+  size_t done = 0;
+  while (done < size) {
+    ssize_t n = read(wal.fd, log + done, size - done);
+    if (n <= 0) break;
+    done += (size_t)n;
+  }
+
+  size_t offset = 0;
+  int result = 0;
+
+  while (offset + WAL_HEADER_SIZE + WAL_CHECKSUM_SIZE <= done) {
+    uint32_t len, sum;
+    memcpy(&len, log + offset + 1, sizeof(len));
+
+    if (len > done - offset - WAL_HEADER_SIZE - WAL_CHECKSUM_SIZE) break;
+
+    memcpy(&sum, log + offset + WAL_HEADER_SIZE + len, sizeof(sum));
+    if (sum != checksum(log + offset, WAL_HEADER_SIZE + len)) break;
+
+    if (replay_record(log[offset], log + offset + WAL_HEADER_SIZE, len, handlers) != 0) {
+      fprintf(stderr, "Failed to replay log record at offset %llu\n", (unsigned long long)(start + offset));
+      result = 1;
+      break;
+    }
+
+    offset += WAL_HEADER_SIZE + len + WAL_CHECKSUM_SIZE;
+  }
+
+  if (result == 0 && offset < size) {
+    fprintf(stderr, "Discarding %zu bytes of torn log tail\n", size - offset);
+  }
+
+  free(log);
+  *good = (off_t)(start + offset);
+  return result;
+}
+
+int wal_open(const char *path, unsigned int window_us, uint64_t start, const struct WalHandlers *handlers) {
+  if (wal.fd >= 0) {
+    fprintf(stderr, "Log already open\n");
+    return 1;
+  }
+
+  wal.fd = open(path, O_RDWR | O_CREAT, S_IRUSR | S_IWUSR);
+
+  if (wal.fd < 0) {
+    perror("Failed to open log");
+    return 1;
+  }
+
+  off_t good;
+  if (replay(start, handlers, &good) != 0 || ftruncate(wal.fd, good) != 0 || lseek(wal.fd, good, SEEK_SET) < 0) {
+    close(wal.fd);
+    wal.fd = -1;
+    return 1;
+  }
+
+  wal.window_us = window_us;
+  wal.appended = 0;
+  wal.durable = 0;
+  wal.length = (uint64_t)good;
+  wal.leader = 0;
+  wal.failed = 0;
+  writer_init(&wal.pending, 4096);
+  writer_init(&wal.flushing, 4096);
+  return 0;
+}
+
+void wal_close() {
+  if (wal.fd < 0) {
+    return;
+  }
+
+  if (wal_sync(wal.appended) != 0) {
+    fprintf(stderr, "Failed to write log\n");
+  }
+
+  close(wal.fd);
+  wal.fd = -1;
+  writer_destroy(&wal.pending);
+  writer_destroy(&wal.flushing);
+}
+
+uint64_t wal_log_create(unsigned int event_id, size_t num_rows, size_t num_cols) {
+  if (wal.fd < 0) {
+    return 0;
+  }
+
+  char payload[WAL_CREATE_SIZE];
+  uint32_t id = event_id;
+  uint64_t rows = num_rows, cols = num_cols;
+  memcpy(payload, &id, 4);
+  memcpy(payload + 4, &rows, 8);
+  memcpy(payload + 12, &cols, 8);
+
+  pthread_mutex_lock(&wal.lock);
+  uint64_t lsn = append_record(WAL_CREATE, payload, WAL_CREATE_SIZE);
+  pthread_mutex_unlock(&wal.lock);
+
+  return lsn;
+}
+
+uint64_t wal_log_reserve(unsigned int event_id, unsigned int reservation_id, const size_t *seats, size_t num_seats) {
+  if (wal.fd < 0) {
+    return 0;
+  }
+
+  char payload[WAL_RESERVE_SIZE(MAX_RESERVATION_SIZE)];
+  uint32_t id = event_id, reservation = reservation_id, count = (uint32_t)num_seats;
+  memcpy(payload, &id, 4);
+  memcpy(payload + 4, &reservation, 4);
+  memcpy(payload + 8, &count, 4);
+
+  for (size_t i = 0; i < num_seats; i++) {
+    uint64_t seat = seats[i];
+    memcpy(payload + WAL_RESERVE_SIZE(i), &seat, 8);
+  }
+
+  pthread_mutex_lock(&wal.lock);
+  uint64_t lsn = append_record(WAL_RESERVE, payload, (uint32_t)WAL_RESERVE_SIZE(num_seats));
+  pthread_mutex_unlock(&wal.lock);
+
+  return lsn;
+}
+
+uint64_t wal_log_reserve_block(unsigned int event_id, unsigned int reservation_id, size_t first_row, size_t first_col,
+                               size_t num_rows, size_t num_cols) {
+  if (wal.fd < 0) {
+    return 0;
+  }
+
+  char payload[WAL_RESERVE_BLOCK_SIZE];
+  uint32_t id = event_id, reservation = reservation_id;
+  uint64_t row = first_row, col = first_col, rows = num_rows, cols = num_cols;
+  memcpy(payload, &id, 4);
+  memcpy(payload + 4, &reservation, 4);
+  memcpy(payload + 8, &row, 8);
+  memcpy(payload + 16, &col, 8);
+  memcpy(payload + 24, &rows, 8);
+  memcpy(payload + 32, &cols, 8);
+
+  pthread_mutex_lock(&wal.lock);
+  uint64_t lsn = append_record(WAL_RESERVE_BLOCK, payload, WAL_RESERVE_BLOCK_SIZE);
+  pthread_mutex_unlock(&wal.lock);
+
+  return lsn;
+}
+
+int wal_sync(uint64_t lsn) {
+  if (lsn == 0) {
+    return 0;
+  }
+
+  pthread_mutex_lock(&wal.lock);
+
+  while (wal.durable < lsn && !wal.failed) {
+    if (wal.leader) {
+      pthread_cond_wait(&wal.synced, &wal.lock);
+      continue;
+    }
+
+    wal.leader = 1;
+
+    // Give concurrent committers a chance to join the batch before paying for the fsync.
+    if (wal.window_us > 0) {
+      struct timespec window = {wal.window_us / 1000000, (long)(wal.window_us % 1000000) * 1000};
+      pthread_mutex_unlock(&wal.lock);
+      nanosleep(&window, NULL);
+      pthread_mutex_lock(&wal.lock);
+    }
+
+    struct Writer batch = wal.pending;
+    wal.pending = wal.flushing;
+    wal.flushing = batch;
+    uint64_t batch_end = wal.appended;
+
+    pthread_mutex_unlock(&wal.lock);
+
+    size_t batch_len = wal.flushing.len;
+    int result = writer_flush(&wal.flushing, wal.fd);
+    if (result == 0 && fsync(wal.fd) != 0) {
+      result = 1;
+    }
+
+    pthread_mutex_lock(&wal.lock);
+
+    if (result != 0) {
+      wal.failed = 1;
+    } else {
+      wal.durable = batch_end;
+      wal.length += batch_len;
+    }
+
+    wal.leader = 0;
+    pthread_cond_broadcast(&wal.synced);
+  }
+
+  int result = wal.durable < lsn;
+  pthread_mutex_unlock(&wal.lock);
+
+  return result;
+}
+
+int wal_length(uint64_t *length) {
+  *length = 0;
+
+  if (wal.fd < 0) {
+    return 0;
+  }
+
+  pthread_mutex_lock(&wal.lock);
+  uint64_t appended = wal.appended;
+  pthread_mutex_unlock(&wal.lock);
+
+  if (wal_sync(appended) != 0) {
+    return 1;
+  }
+
+  pthread_mutex_lock(&wal.lock);
+  *length = wal.length;
+  pthread_mutex_unlock(&wal.lock);
+  return 0;
+}
@@ -0,0 +1,59 @@
+#ifndef EMS_WAL_H
+#define EMS_WAL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/// Applies the records of a log to the state when it is opened.
+struct WalHandlers {
+  /// Recreates an event. Returns 0 on success.
+  int (*create)(unsigned int event_id, size_t num_rows, size_t num_cols);
+  /// Restores a reservation on the given seat indices. Returns 0 on success.
+  int (*reserve)(unsigned int event_id, unsigned int reservation_id, const size_t *seats, size_t num_seats);
+  /// Restores a reservation of a rectangle of seats, rows and columns starting at 0. Returns 0 on success.
+  int (*reserve_block)(unsigned int event_id, unsigned int reservation_id, size_t first_row, size_t first_col,
+                       size_t num_rows, size_t num_cols);
+};
+
+/// Opens the write-ahead log, replaying the records already in it before new ones are appended.
+/// @note A torn or corrupt record ends the replay, and the log is cut back to the last good one.
+/// @param path Path of the log, created if missing.
+/// @param window_us How long the first committer of a batch waits for others to join it.
+/// @param start Length of the log the state already reflects, such as the one recorded in the
+/// snapshot it was loaded from. Only the records after it are replayed.
+/// @param handlers Functions to apply the replayed records with.
+/// @return 0 if the log was opened and replayed successfully, 1 otherwise.
+int wal_open(const char *path, unsigned int window_us, uint64_t start, const struct WalHandlers *handlers);
+
+/// Closes the log. Records that were appended but never synced are written out first.
+void wal_close();
+
+/// Appends an event creation to the log, in memory.
+/// @return Sequence number of the record to pass to wal_sync, 0 if no log is open.
+uint64_t wal_log_create(unsigned int event_id, size_t num_rows, size_t num_cols);
+
+/// Appends a reservation to the log, in memory.
+/// @return Sequence number of the record to pass to wal_sync, 0 if no log is open.
+uint64_t wal_log_reserve(unsigned int event_id, unsigned int reservation_id, const size_t *seats, size_t num_seats);
+
+/// Appends a reservation of a rectangle of seats to the log, in memory.
+/// @note Takes constant space however many seats the rectangle covers.
+/// @param first_row Row of the top left seat, starting at 0.
+/// @param first_col Column of the top left seat, starting at 0.
+/// @return Sequence number of the record to pass to wal_sync, 0 if no log is open.
+uint64_t wal_log_reserve_block(unsigned int event_id, unsigned int reservation_id, size_t first_row, size_t first_col,
+                               size_t num_rows, size_t num_cols);
+
+/// Waits until a record and every record before it are on disk. Concurrent callers are written
+/// out together and share a single fsync.
+/// @param lsn Sequence number of the record, 0 to return at once.
+/// @return 0 if the record is durable, 1 if the log could not be written.
+int wal_sync(uint64_t lsn);
+
+/// Writes out every record appended so far and gets the length of the log, which a snapshot of the
+/// state at this point covers.
+/// @param length Set to the length of the log in bytes, 0 if no log is open.
+/// @return 0 if every record is durable, 1 if the log could not be written.
+int wal_length(uint64_t *length);
+
+#endif  // EMS_WAL_H
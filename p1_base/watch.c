@@ -0,0 +1,355 @@
+#include "watch.h"
+
+#include <stdio.h>
+
+#ifdef __linux__
+
+#include <dirent.h>
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+#define JOB_SUFFIX ".jobs"
+
+/// Job file waiting for a worker.
+struct WatchJob {
+  char path[PATH_MAX];
+  struct WatchJob *next;
+};
+
+/// One of the threads running job files.
+struct WatchWorker {
+  pthread_t thread;
+  char path[PATH_MAX];  // Job file being run, empty while idle
+  int running;
+};
+
+/// Job files waiting to be run, filled by the main thread and drained by the workers.
+struct WatchQueue {
+  struct WatchJob *head;
+  struct WatchJob **tail;
+  struct WatchWorker *workers;
+  unsigned int num_workers;
+  watch_job_fn run;
+  int closed;  // Set on shutdown; workers leave once the queue is empty
+  pthread_mutex_t lock;
+  pthread_cond_t changed;  // Signalled when a job is queued or finished, or the queue is closed
+};
+
+static struct WatchQueue queue = {.lock = PTHREAD_MUTEX_INITIALIZER, .changed = PTHREAD_COND_INITIALIZER};
+
+static int stop_pipe[2] = {-1, -1};
+
+/// Asks the main thread to shut down, waking it up with a byte on the stop pipe.
+static void handle_stop(int sig) {
+  (void)sig;
+  char byte = 0;
+
+  if (write(stop_pipe[1], &byte, 1) < 0) {
+    // Nothing else can be done in a signal handler; the pipe already holds a byte.
+  }
+}
+
+static int is_job_file(const char *name) {
+  size_t len = strlen(name);
+  size_t suffix_len = strlen(JOB_SUFFIX);
+
+  return len > suffix_len && strcmp(name + len - suffix_len, JOB_SUFFIX) == 0;
+}
+
+/// Queues a job file, unless it is already waiting.
+/// @return 0 if the file was queued or already waiting, 1 if memory ran out.
+static int queue_push(const char *path) {
+  pthread_mutex_lock(&queue.lock);
+
+  for (struct WatchJob *job = queue.head; job != NULL; job = job->next) {
+    if (strcmp(job->path, path) == 0) {
+      pthread_mutex_unlock(&queue.lock);
+      return 0;
+    }
+  }
+
+  struct WatchJob *job = malloc(sizeof(struct WatchJob));
+
+  if (job == NULL) {
+    pthread_mutex_unlock(&queue.lock);
+    return 1;
+  }
+
+  strcpy(job->path, path);
+  job->next = NULL;
+  *queue.tail = job;
+  queue.tail = &job->next;
+
+  pthread_cond_broadcast(&queue.changed);
+  pthread_mutex_unlock(&queue.lock);
+  return 0;
+}
+
+/// Checks whether a worker is running a job file.
+static int is_running(const char *path) {
+  for (unsigned int i = 0; i < queue.num_workers; i++) {
+    if (queue.workers[i].running && strcmp(queue.workers[i].path, path) == 0) {
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+/// Takes the oldest job file no other worker is running, waiting while there is none.
+/// @return 0 if a job file was taken into the path of the worker, 1 if the queue was closed and
+/// is empty.
+static int queue_pop(struct WatchWorker *worker) {
+  pthread_mutex_lock(&queue.lock);
+
+  for (;;) {
+    struct WatchJob **link = &queue.head;
+
+    while (*link != NULL && is_running((*link)->path)) {
+      link = &(*link)->next;
+    }
+
+    if (*link != NULL) {
+      struct WatchJob *job = *link;
+
+      *link = job->next;
+      if (queue.tail == &job->next) {
+        queue.tail = link;
+      }
+
+      strcpy(worker->path, job->path);
+      worker->running = 1;
+      free(job);
+
+      pthread_mutex_unlock(&queue.lock);
+      return 0;
+    }
+
+    if (queue.closed && queue.head == NULL) {
+      pthread_mutex_unlock(&queue.lock);
+      return 1;
+    }
+
+    pthread_cond_wait(&queue.changed, &queue.lock);
+  }
+}
+
+/// Marks the job file of a worker as finished, letting a queued run of the same file go ahead.
+static void queue_done(struct WatchWorker *worker) {
+  pthread_mutex_lock(&queue.lock);
+  worker->running = 0;
+  pthread_cond_broadcast(&queue.changed);
+  pthread_mutex_unlock(&queue.lock);
+}
+
+/// Lets the workers leave once the job files already queued are run.
+static void queue_close() {
+  pthread_mutex_lock(&queue.lock);
+  queue.closed = 1;
+  pthread_cond_broadcast(&queue.changed);
+  pthread_mutex_unlock(&queue.lock);
+}
+
+static void *watch_worker(void *arg) {
+  struct WatchWorker *worker = (struct WatchWorker *)arg;
+  char out_path[PATH_MAX];
+
+  while (queue_pop(worker) == 0) {
+    strcpy(out_path, worker->path);
+    strcpy(strrchr(out_path, '.'), ".out");
+
+    queue.run(worker->path, out_path);
+    queue_done(worker);
+  }
+
+  return NULL;
+}
+
+/// Queues a job file of the directory by name, ignoring any other file.
+/// @return 0 if the file was queued or ignored, 1 otherwise.
+static int schedule(const char *dir_path, const char *name) {
+  char path[PATH_MAX];
+
+  if (!is_job_file(name)) {
+    return 0;
+  }
+
+  if ((size_t)snprintf(path, PATH_MAX, "%s/%s", dir_path, name) >= PATH_MAX) {
+    fprintf(stderr, "Job file path too long: %s\n", name);
+    return 0;
+  }
+
+  if (queue_push(path) != 0) {
+    fprintf(stderr, "Error allocating memory for job file\n");
+    return 1;
+  }
+
+  printf("%s\n", name);
+  fflush(stdout);
+  return 0;
+}
+
+/// Queues every job file already in the directory.
+/// @return 0 if the directory was read successfully, 1 otherwise.
+static int schedule_directory(const char *dir_path) {
+  DIR *dir = opendir(dir_path);
+
+  if (dir == NULL) {
+    perror("Failed to open jobs directory");
+    return 1;
+  }
+
+  int result = 0;
+  struct dirent *dp;
+
+  while (result == 0 && (dp = readdir(dir)) != NULL) {
+    result = schedule(dir_path, dp->d_name);
+  }
+
+  closedir(dir);
+  return result;
+}
+
+/// Queues the job files named by a batch of inotify events.
+/// @return 0 if the watch can go on, 1 otherwise.
+static int handle_events(const char *dir_path, const char *buffer, size_t len) {
+  const struct inotify_event *event;
+
+  for (size_t offset = 0; offset < len; offset += sizeof(struct inotify_event) + event->len) {
+    event = (const struct inotify_event *)(const void *)(buffer + offset);
+
+    if (event->mask & IN_Q_OVERFLOW) {
+      // Events were dropped, so the directory is the only way to know what arrived.
+      if (schedule_directory(dir_path) != 0) {
+        return 1;
+      }
+    } else if (event->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED)) {
+      fprintf(stderr, "Jobs directory is gone\n");
+      return 1;
+    } else if (event->len > 0 && schedule(dir_path, event->name) != 0) {
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+int ems_watch(const char *dir_path, unsigned int max_workers, watch_job_fn run) {
+  // Watched before the directory is read, so that no file falls between the two.
+  int inotify_fd = inotify_init1(IN_CLOEXEC);
+
+  if (inotify_fd < 0) {
+    perror("Failed to start watching");
+    return 1;
+  }
+
+  if (inotify_add_watch(inotify_fd, dir_path, IN_CLOSE_WRITE | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF) < 0) {
+    perror("Failed to watch jobs directory");
+    close(inotify_fd);
+    return 1;
+  }
+
+  if (pipe(stop_pipe) != 0) {
+    perror("Failed to create stop pipe");
+    close(inotify_fd);
+    return 1;
+  }
+
+  struct sigaction action = {0};
+  action.sa_handler = handle_stop;
+  sigemptyset(&action.sa_mask);
+  action.sa_flags = SA_RESTART;
+  sigaction(SIGINT, &action, NULL);
+  sigaction(SIGTERM, &action, NULL);
+
+  struct WatchWorker *workers = calloc(max_workers, sizeof(struct WatchWorker));
+
+  if (workers == NULL) {
+    fprintf(stderr, "Error allocating memory for workers\n");
+    close(stop_pipe[0]);
+    close(stop_pipe[1]);
+    close(inotify_fd);
+    return 1;
+  }
+
+  queue.head = NULL;
+  queue.tail = &queue.head;
+  queue.workers = workers;
+  queue.num_workers = max_workers;
+  queue.run = run;
+  queue.closed = 0;
+
+  unsigned int started = 0;
+  for (; started < max_workers; started++) {
+    if (pthread_create(&workers[started].thread, NULL, watch_worker, &workers[started]) != 0) {
+      fprintf(stderr, "Failed to create worker thread\n");
+      break;
+    }
+  }
+
+  int result = started == 0 || schedule_directory(dir_path) != 0;
+
+  // Large enough for a batch of events, aligned as inotify_event requires.
+  char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+  struct pollfd fds[2] = {{.fd = inotify_fd, .events = POLLIN}, {.fd = stop_pipe[0], .events = POLLIN}};
+
+  while (result == 0) {
+    if (poll(fds, 2, -1) < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      perror("Failed to wait for job files");
+      result = 1;
+      break;
+    }
+
+    if (fds[1].revents != 0) {
+      break;
+    }
+
+    ssize_t len = read(inotify_fd, buffer, sizeof(buffer));
+
+    if (len < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      perror("Failed to read directory events");
+      result = 1;
+      break;
+    }
+
+    result = handle_events(dir_path, buffer, (size_t)len);
+  }
+
+  queue_close();
+
+  for (unsigned int i = 0; i < started; i++) {
+    pthread_join(workers[i].thread, NULL);
+  }
+
+  free(workers);
+  close(stop_pipe[0]);
+  close(stop_pipe[1]);
+  close(inotify_fd);
+  return result;
+}
+
+#else
+
+int ems_watch(const char *dir_path, unsigned int max_workers, watch_job_fn run) {
+  (void)dir_path;
+  (void)max_workers;
+  (void)run;
+
+  fprintf(stderr, "Watching a jobs directory is only supported on Linux\n");
+  return 1;
+}
+
+#endif
@@ -0,0 +1,18 @@
+#ifndef EMS_WATCH_H
+#define EMS_WATCH_H
+
+/// Runs a job file, writing its output to the given path.
+typedef void (*watch_job_fn)(const char *path, const char *out_path);
+
+/// Runs the job files of a directory as they arrive, until SIGINT or SIGTERM is received.
+/// @note Files already in the directory are run first; after that, a job file is run every time it
+/// is closed after being written or moved into the directory. A file is never run by two workers at
+/// the same time: changes while it is queued are run once, and changes while it runs queue it
+/// again. On shutdown, files already queued are run before returning. Only supported on Linux.
+/// @param dir_path Path of the directory to watch.
+/// @param max_workers Number of job files run at the same time.
+/// @param run Function running each job file, called from the worker threads.
+/// @return 0 if the watch shut down cleanly, 1 otherwise.
+int ems_watch(const char *dir_path, unsigned int max_workers, watch_job_fn run);
+
+#endif  // EMS_WATCH_H
@@ -0,0 +1,125 @@
+#include "writer.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/// Two-digit decimal representations of 0 to 99, to convert integers two digits at a time.
+static const char digit_pairs[] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+/// Makes room for count more bytes.
+/// @return 0 if there is room, 1 otherwise.
+static int writer_reserve(struct Writer *writer, size_t count) {
+  if (writer->error) {
+    return 1;
+  }
+
+  if (writer->len + count <= writer->cap) {
+    return 0;
+  }
+
+  size_t cap = writer->cap ? writer->cap : 64;
+  while (cap < writer->len + count) {
+    cap *= 2;
+  }
+
+  char *data = realloc(writer->data, cap);
+  if (data == NULL) {
+    writer->error = 1;
+    return 1;
+  }
+
+  writer->data = data;
+  writer->cap = cap;
+  return 0;
+}
+
+void writer_init(struct Writer *writer, size_t capacity) {
+  writer->data = NULL;
+  writer->len = 0;
+  writer->cap = 0;
+  writer->error = 0;
+  writer_reserve(writer, capacity);
+}
+
+void writer_destroy(struct Writer *writer) {
+  free(writer->data);
+  writer->data = NULL;
+  writer->len = 0;
+  writer->cap = 0;
+}
+
+void writer_put(struct Writer *writer, const char *src, size_t count) {
+  if (writer_reserve(writer, count) != 0) {
+    return;
+  }
+
+  memcpy(writer->data + writer->len, src, count);
+  writer->len += count;
+}
+
+void writer_put_char(struct Writer *writer, char ch) {
+  if (writer_reserve(writer, 1) != 0) {
+    return;
+  }
+
+  writer->data[writer->len++] = ch;
+}
+
+void writer_put_uint(struct Writer *writer, unsigned int value) {
+  char buf[16];
+  char *end = buf + sizeof(buf);
+  char *p = end;
+
+  while (value >= 100) {
+    unsigned int pair = (value % 100) * 2;
+    value /= 100;
+    *--p = digit_pairs[pair + 1];
+    *--p = digit_pairs[pair];
+  }
+
+  if (value >= 10) {
+    *--p = digit_pairs[value * 2 + 1];
+    *--p = digit_pairs[value * 2];
+  } else {
+    *--p = (char)('0' + value);
+  }
+
+  writer_put(writer, p, (size_t)(end - p));
+}
+
+int writer_flush(struct Writer *writer, int fd) {
+  if (writer->error) {
+    writer->len = 0;
+    return 1;
+  }
+
+  size_t done = 0;
+  while (done < writer->len) {
+    ssize_t n = write(fd, writer->data + done, writer->len - done);
+
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      writer->len = 0;
+      return 1;
+    }
+
+    done += (size_t)n;
+  }
+
+  writer->len = 0;
+  return 0;
+}
@@ -0,0 +1,45 @@
+#ifndef EMS_WRITER_H
+#define EMS_WRITER_H
+
+#include <stddef.h>
+
+/// Growable output buffer, formatted in memory and written out in as few system calls as possible.
+struct Writer {
+  char *data;  /// Buffered output.
+  size_t len;  /// Number of bytes buffered.
+  size_t cap;  /// Capacity of the buffer.
+  int error;   /// Set once the buffer could not grow; later output is dropped.
+};
+
+/// Initializes an empty writer.
+/// @param writer Writer to initialize.
+/// @param capacity Number of bytes to reserve up front.
+void writer_init(struct Writer *writer, size_t capacity);
+
+/// Frees the buffer of a writer.
+/// @param writer Writer to destroy.
+void writer_destroy(struct Writer *writer);
+
+/// Appends bytes to the buffer.
+/// @param writer Writer to append to.
+/// @param src Bytes to append.
+/// @param count Number of bytes to append.
+void writer_put(struct Writer *writer, const char *src, size_t count);
+
+/// Appends a single character to the buffer.
+/// @param writer Writer to append to.
+/// @param ch Character to append.
+void writer_put_char(struct Writer *writer, char ch);
+
+/// Appends the decimal representation of an unsigned integer to the buffer.
+/// @param writer Writer to append to.
+/// @param value Value to append.
+void writer_put_uint(struct Writer *writer, unsigned int value);
+
+/// Writes the whole buffer to a file descriptor and empties it.
+/// @param writer Writer to flush.
+/// @param fd File descriptor to write to.
+/// @return 0 if everything was written, 1 otherwise.
+int writer_flush(struct Writer *writer, int fd);
+
+#endif  // EMS_WRITER_H